@@ -84,6 +84,20 @@ static CDC_LineEncoding_t LineEncoding = { .BaudRateBPS = 0,
 register uint8_t bankTX asm("r6");
 //static uint8_t bankTX = 0;
 
+#if !defined(NO_BLOCK_SUPPORT) && !defined(NO_OVERLAPPED_WRITE_SUPPORT)
+/** RAM copy of the flash page being received by a block write. The temporary page buffer can only be filled once the
+*  page erase has finished, so the data is collected here while the erase runs.
+*/
+static uint8_t PageBuffer[SPM_PAGESIZE];
+#endif
+
+#if !defined(NO_LAZY_CHIP_ERASE_SUPPORT)
+/** One bit per application flash page that still holds data after a chip erase. A chip erase only marks the pages,
+*  they are erased when they are first written, or all at once before flash is read or the bootloader exits.
+*/
+static uint8_t PagesToErase[((BOOT_START_ADDR / SPM_PAGESIZE) + 7) / 8];
+#endif
+
 /** Current address counter. This stores the current address of the FLASH or EEPROM as set by the host,
 *  and is used when reading or writing to the AVRs memory (either FLASH or EEPROM depending on the issued
 *  command.)
@@ -210,6 +224,11 @@ static void StartSketch(void)
 }
 
 static void ResetMCU(void){
+	#if !defined(NO_LAZY_CHIP_ERASE_SUPPORT)
+	// Finish a chip erase before the application may run
+	ErasePendingPages();
+	#endif
+
 	/* Wait a short time to end all USB transactions and then disconnect */
 	_delay_us(1000);
 
@@ -289,8 +308,21 @@ int main(void)
 						LEDs_TurnOffRXLED;
 
 					// Don't decrement timeout if there is usb activity or if flash is erased
-					if (countRX == 0 && (pgm_read_word(0) != 0xFFFF)) {
-						if (!(Timeout--)) {
+					// (a page 0 only marked by a lazy chip erase counts as erased)
+					if ((countRX == 0)
+					#if !defined(NO_LAZY_CHIP_ERASE_SUPPORT)
+					&& !(PagesToErase[0] & 1)
+					#endif
+					) {
+						#if !defined(NO_OVERLAPPED_WRITE_SUPPORT)
+						// Flash can't be read while a block write's page is still being written,
+						// or until the RWW section has been enabled again after it
+						boot_spm_busy_wait();
+						if (boot_rww_busy())
+							boot_rww_enable();
+						#endif
+
+						if ((pgm_read_word(0) != 0xFFFF) && !(Timeout--)) {
 							RunBootloader = false;
 						}
 					}
@@ -431,14 +463,15 @@ void EVENT_USB_Device_ControlRequest(void)
 	}
 }
 
-/** Retrieves the next byte from the host in the CDC data OUT endpoint, and clears the endpoint bank if needed
-*  to allow reception of the next data packet from the host.
+/** Selects the CDC data OUT endpoint and waits until it holds unread data, clearing an emptied bank first to
+*  allow reception of the next data packet from the host. The caller reads up to the returned number of bytes
+*  with Endpoint_Read_8().
 *
-*  \return Next received byte from the host in the CDC data OUT endpoint
+*  \return Number of bytes available in the current OUT bank, or 0 if the device was detached while waiting
 */
-static uint8_t FetchNextCommandByte(void)
+static uint8_t PrepareCommandBank(void)
 {
-	/* Select the OUT endpoint so that the next data byte can be read */
+	/* Select the OUT endpoint so that the next data bytes can be read */
 	Endpoint_SelectEndpoint(CDC_RX_EPADDR);
 
 	/* If OUT endpoint empty, clear it and wait for the next packet from the host */
@@ -453,52 +486,99 @@ static uint8_t FetchNextCommandByte(void)
 		}while (!(Endpoint_IsOUTReceived()));
 	}
 
+	return Endpoint_BytesInEndpoint();
+}
+
+/** Retrieves the next byte from the host in the CDC data OUT endpoint, waiting for the next packet if the current
+*  bank has been read.
+*
+*  \return Next received byte from the host in the CDC data OUT endpoint, or 0 if the device was detached
+*/
+static uint8_t FetchNextCommandByte(void)
+{
+	if (!(PrepareCommandBank()))
+	  return 0;
+
 	/* Fetch the next byte from the OUT endpoint */
 	return Endpoint_Read_8();
 }
 
-/** Writes the next response byte to the CDC data IN endpoint, and sends the endpoint back if needed to free up the
-*  bank when full ready for the next byte in the packet to the host.
+/** Selects the CDC data IN endpoint and makes room in it for the next response bytes, sending the bank back to the
+*  host first if it is already full. The caller writes up to the returned number of bytes with Endpoint_Write_8()
+*  and adds them to \c bankTX.
 *
-*  \param[in] Response  Next response byte to send to the host
+*  \return Number of bytes still free in the current IN bank, or 0 if the device was detached while waiting
 */
-static void WriteNextResponseByte(const uint8_t Response)
+static uint8_t PrepareResponseBank(void)
 {
-	/* Select the IN endpoint so that the next data byte can be written */
+	/* Select the IN endpoint so that the next data bytes can be written */
 	Endpoint_SelectEndpoint(CDC_TX_EPADDR);
 
+	// A full bank is only sent once the next byte needs room.
+	// This way the end of Bootloader_Task() still knows if the last packet was full
+	// and the transfer has to be terminated with a Zero Length Packet (ZLP).
+	if(bankTX >= CDC_TX_EPSIZE){
+		bankTX = 0;
+		Endpoint_ClearIN();
+	}
+
 	// Wait untill endpoint is ready to write
 	do
 	{
 		if (USB_DeviceState == DEVICE_STATE_Unattached)
-		return;
+		return 0;
 	}while (!(Endpoint_IsINReady()));
 
+	return (CDC_TX_EPSIZE - bankTX);
+}
+
+/** Writes the next response byte to the CDC data IN endpoint, sending the bank to the host first if it is full.
+*  A full bank is kept until the next byte needs room, so the end of the command still knows to send a ZLP.
+*
+*  \param[in] Response  Next response byte to send to the host
+*/
+static void WriteNextResponseByte(const uint8_t Response)
+{
+	if (!(PrepareResponseBank()))
+	  return;
+
 	/* Write the next byte to the IN endpoint */
 	Endpoint_Write_8(Response);
 	bankTX++;
-
-	// Send a maximum of up to one bank minus one.
-	// If we fill the whole bank we'd have to send an empty Zero Length Packet (ZLP)
-	// afterwards to determine the end of the transfer.
-	// Since this is more complicated we only send single packets
-	// with one byte less than the maximum.
-	if(bankTX >= (CDC_TX_EPSIZE - 1)){
-		bankTX = 0;
-		Endpoint_ClearIN();
-	}
 }
 
-/** Task to read in AVR109 commands from the CDC data OUT endpoint, process them, perform the required actions
-*  and send the appropriate response back to the host.
+/** Answers a command the bootloader cannot carry out with the AVR109 fail code and discards the rest of the OUT
+*  packet, so that arguments or data following the command are not taken as further commands.
 */
-static void Bootloader_Task(){
-	// Initialize/reset register variables
-	bankTX = 0;
+static void RejectCommand(void)
+{
+	/* Send error byte back to the host */
+	WriteNextResponseByte('?');
 
+	/* Select the OUT endpoint and release the rest of the packet */
+	Endpoint_SelectEndpoint(CDC_RX_EPADDR);
+	Endpoint_ClearOUT();
+}
+
+/** Reads in a single AVR109 command from the CDC data OUT endpoint, performs the required actions and queues the
+*  appropriate response for the host.
+*
+*  \return Boolean \c false if the command was rejected and the OUT packet has already been released, \c true otherwise
+*/
+static bool ProcessNextCommand(void)
+{
 	/* Read in the bootloader command (first byte sent from host) */
 	uint8_t Command = FetchNextCommandByte();
 
+	#if !defined(NO_OVERLAPPED_WRITE_SUPPORT)
+	// A flash block write returns while its page is still being written.
+	// Wait for the SPM to finish before anything that reads flash, uses the SPM or the EEPROM, or exits.
+	// Setting the address and the next block write (which waits itself) carry on in parallel.
+	if ((Command != AVR109_COMMAND_SetCurrentAddress) && (Command != AVR109_COMMAND_BlockWrite) &&
+	(Command != AVR109_COMMAND_BlockWriteRLE))
+		boot_spm_busy_wait();
+	#endif
+
 	if (Command == AVR109_COMMAND_ExitBootloader)
 	{
 		RunBootloader = false;
@@ -563,6 +643,27 @@ static void Bootloader_Task(){
 	}
 	else if (Command == AVR109_COMMAND_EraseFLASH)
 	{
+		#if !defined(NO_LAZY_CHIP_ERASE_SUPPORT)
+		/* Note which pages of the application section hold data, blank pages never need erasing */
+		boot_spm_busy_wait();
+		boot_rww_enable();
+
+		for (uint32_t CurrFlashAddress = 0; CurrFlashAddress < (uint32_t)BOOT_START_ADDR; CurrFlashAddress++)
+		{
+			#if (FLASHEND > 0xFFFF)
+			if (pgm_read_byte_far(CurrFlashAddress) != 0xFF)
+			#else
+			if (pgm_read_byte(CurrFlashAddress) != 0xFF)
+			#endif
+			{
+				uint16_t CurrPage = (CurrFlashAddress / SPM_PAGESIZE);
+				PagesToErase[CurrPage / 8] |= (1 << (CurrPage % 8));
+
+				/* Skip the rest of the page */
+				CurrFlashAddress |= (SPM_PAGESIZE - 1);
+			}
+		}
+		#else
 		/* Clear the application section of flash */
 		for (uint32_t CurrFlashAddress = 0; CurrFlashAddress < (uint32_t)BOOT_START_ADDR; CurrFlashAddress += SPM_PAGESIZE)
 		{
@@ -571,6 +672,7 @@ static void Bootloader_Task(){
 			boot_page_write(CurrFlashAddress);
 			boot_spm_busy_wait();
 		}
+		#endif
 
 		/* Send confirmation byte back to the host */
 		WriteNextResponseByte('\r');
@@ -610,10 +712,17 @@ static void Bootloader_Task(){
 		WriteNextResponseByte(SPM_PAGESIZE >> 8);
 		WriteNextResponseByte(SPM_PAGESIZE & 0xFF);
 	}
-	else if ((Command == AVR109_COMMAND_BlockWrite) || (Command == AVR109_COMMAND_BlockRead))
+	else if (
+	#if !defined(NO_BLOCK_CRC_SUPPORT)
+	(Command == AVR109_COMMAND_BlockCRC) ||
+	#endif
+	#if !defined(NO_BLOCK_RLE_SUPPORT)
+	(Command == AVR109_COMMAND_BlockWriteRLE) ||
+	#endif
+	(Command == AVR109_COMMAND_BlockWrite) || (Command == AVR109_COMMAND_BlockRead))
 	{
 		/* Delegate the block write/read to a separate function for clarity */
-		ReadWriteMemoryBlock(Command);
+		return ReadWriteMemoryBlock(Command);
 	}
 	#endif
 	#if !defined(NO_FLASH_BYTE_SUPPORT)
@@ -638,17 +747,43 @@ static void Bootloader_Task(){
 	}
 	else if (Command == AVR109_COMMAND_WriteFlashPage)
 	{
+		#if !defined(NO_LAZY_CHIP_ERASE_SUPPORT)
+		/* A chip erase only marks the pages, so erase this one first if it is still marked. The temporary page buffer
+		* filled by the host is kept through the erase. */
+		if (CurrAddress < BOOT_START_ADDR)
+		{
+			uint16_t CurrPage = (CurrAddress / SPM_PAGESIZE);
+
+			if (PagesToErase[CurrPage / 8] & (1 << (CurrPage % 8)))
+			{
+				boot_page_erase(CurrAddress);
+				boot_spm_busy_wait();
+				PagesToErase[CurrPage / 8] &= ~(1 << (CurrPage % 8));
+			}
+		}
+		#endif
+
 		/* Commit the flash page to memory */
 		boot_page_write(CurrAddress);
 
 		/* Wait until write operation has completed */
 		boot_spm_busy_wait();
 
+		#if !defined(NO_OVERLAPPED_WRITE_SUPPORT)
+		/* Enable the RWW section again while the temporary page buffer is empty. Left to the main loop, that could
+		* happen while the host fills the next page, and would discard the bytes filled so far. */
+		boot_rww_enable();
+		#endif
+
 		/* Send confirmation byte back to the host */
 		WriteNextResponseByte('\r');
 	}
 	else if (Command == AVR109_COMMAND_ReadFLASHWord)
 	{
+		#if !defined(NO_LAZY_CHIP_ERASE_SUPPORT)
+		ErasePendingPages();
+		#endif
+
 		#if (FLASHEND > 0xFFFF)
 		uint16_t ProgramWord = pgm_read_word_far(CurrAddress);
 		#else
@@ -683,9 +818,37 @@ static void Bootloader_Task(){
 	else if (Command != AVR109_COMMAND_Sync)
 	{
 		/* Unknown (non-sync) command, return fail code */
-		WriteNextResponseByte('?');
+		RejectCommand();
+
+		return false;
 	}
 
+	return true;
+}
+
+/** Task to read in AVR109 commands from the CDC data OUT endpoint, process them, perform the required actions
+*  and send the appropriate response back to the host.
+*/
+static void Bootloader_Task(){
+	// Initialize/reset register variables
+	bankTX = 0;
+
+	bool PacketHeld;
+
+	#if !defined(NO_PACKED_COMMAND_SUPPORT)
+	// Process the commands back to back while the host has packed more into the same packet.
+	// A command may continue in the next packet, and all responses share the IN packets.
+	do
+	{
+		PacketHeld = ProcessNextCommand();
+
+		Endpoint_SelectEndpoint(CDC_RX_EPADDR);
+	}
+	while (PacketHeld && Endpoint_IsReadWriteAllowed() && (USB_DeviceState != DEVICE_STATE_Unattached));
+	#else
+	PacketHeld = ProcessNextCommand();
+	#endif
+
 	// Check if there is still data in the USB bank that needs to be send
 	if(bankTX)
 	{
@@ -701,9 +864,25 @@ static void Bootloader_Task(){
 
 		// Send the endpoint data to the host */
 		Endpoint_ClearIN();
+
+		// A full last packet does not end the transfer, send a ZLP after it
+		if(bankTX >= CDC_TX_EPSIZE){
+			do{
+				if (USB_DeviceState == DEVICE_STATE_Unattached)
+				return;
+			}
+			while (!(Endpoint_IsINReady()));
+
+			Endpoint_ClearIN();
+		}
 		// bankTX will be reset in the next loop, no need to do it here
 	}
 
+	// A rejected command has already released the OUT packet, and clearing
+	// it again could discard the next packet from the host
+	if (!(PacketHeld))
+		return;
+
 	// In Bootloader mode clear the Out endpoint
 	// Select the OUT endpoint
 	Endpoint_SelectEndpoint(CDC_RX_EPADDR);
@@ -714,96 +893,256 @@ static void Bootloader_Task(){
 }
 
 #if !defined(NO_BLOCK_SUPPORT)
-/** Reads or writes a block of EEPROM or FLASH memory to or from the appropriate CDC data endpoint, depending
-*  on the AVR109 protocol command issued.
+/** Reads or writes a block of EEPROM or FLASH memory to or from the appropriate CDC data endpoint, or returns the
+*  CRC16 of the block, depending on the AVR109 protocol command issued. FLASH blocks can also be written from run-length
+*  encoded data.
 *
 *  \param[in] Command  Single character AVR109 protocol command indicating what memory operation to perform
+*
+*  \return Boolean \c false if the command was rejected and the OUT packet has already been released, \c true otherwise
 */
-static void ReadWriteMemoryBlock(const uint8_t Command)
+static bool ReadWriteMemoryBlock(const uint8_t Command)
 {
 	uint16_t BlockSize;
 	char     MemoryType;
 
 	uint8_t  HighByte = 0;
-	uint8_t  LowByte = 0;
 
 	BlockSize = (FetchNextCommandByte() << 8);
 	BlockSize |= FetchNextCommandByte();
 
 	MemoryType = FetchNextCommandByte();
 
-	if ((MemoryType != MEMORY_TYPE_FLASH) && (MemoryType != MEMORY_TYPE_EEPROM))
+	/* Compressed blocks can only be written to FLASH */
+	if (((MemoryType != MEMORY_TYPE_FLASH) && (MemoryType != MEMORY_TYPE_EEPROM)) ||
+	((Command == AVR109_COMMAND_BlockWriteRLE) && (MemoryType != MEMORY_TYPE_FLASH)))
 	{
-		/* Send error byte back to the host */
-		WriteNextResponseByte('?');
+		RejectCommand();
 
-		return;
+		return false;
 	}
 
-	/* Check if command is to read a memory block */
-	if (Command == AVR109_COMMAND_BlockRead)
+	/* Check if command is to read a memory block, or to checksum it */
+	if ((Command == AVR109_COMMAND_BlockRead) || (Command == AVR109_COMMAND_BlockCRC))
 	{
+		#if !defined(NO_BLOCK_CRC_SUPPORT)
+		uint16_t Checksum = 0;
+		#endif
+
+		#if !defined(NO_LAZY_CHIP_ERASE_SUPPORT)
+		/* Pages still marked by a chip erase must read back blank */
+		ErasePendingPages();
+		#endif
+
 		/* Re-enable RWW section */
 		boot_rww_enable();
 
-		while (BlockSize--)
+		while (BlockSize)
 		{
-			if (MemoryType == MEMORY_TYPE_FLASH)
-			{
-				/* Read the next FLASH byte from the current FLASH page */
-				#if (FLASHEND > 0xFFFF)
-				WriteNextResponseByte(pgm_read_byte_far(CurrAddress | HighByte));
-				#else
-				WriteNextResponseByte(pgm_read_byte(CurrAddress | HighByte));
-				#endif
+			uint8_t ChunkSize = CDC_TX_EPSIZE;
 
-				/* If both bytes in current word have been read, increment the address counter */
-				if (HighByte)
-				CurrAddress += 2;
+			// A block read fills the IN bank a packet at a time, so the endpoint
+			// is only selected and polled once per packet instead of per byte
+			#if !defined(NO_BLOCK_CRC_SUPPORT)
+			if (Command != AVR109_COMMAND_BlockCRC)
+			#endif
+			{
+				ChunkSize = PrepareResponseBank();
 
-				HighByte = !HighByte;
+				if (!(ChunkSize))
+				  return true;
 			}
-			else
+
+			if (ChunkSize > BlockSize)
+			  ChunkSize = BlockSize;
+
+			BlockSize -= ChunkSize;
+
+			while (ChunkSize--)
 			{
-				/* Read the next EEPROM byte into the endpoint */
-				WriteNextResponseByte(eeprom_read_byte((uint8_t*)(intptr_t)(CurrAddress >> 1)));
+				uint8_t Data;
 
-				/* Increment the address counter after use */
-				CurrAddress += 2;
+				if (MemoryType == MEMORY_TYPE_FLASH)
+				{
+					/* Read the next FLASH byte from the current FLASH page */
+					#if (FLASHEND > 0xFFFF)
+					Data = pgm_read_byte_far(CurrAddress | HighByte);
+					#else
+					Data = pgm_read_byte(CurrAddress | HighByte);
+					#endif
+
+					/* If both bytes in current word have been read, increment the address counter */
+					if (HighByte)
+					CurrAddress += 2;
+
+					HighByte = !HighByte;
+				}
+				else
+				{
+					/* Read the next EEPROM byte */
+					Data = eeprom_read_byte((uint8_t*)(intptr_t)(CurrAddress >> 1));
+
+					/* Increment the address counter after use */
+					CurrAddress += 2;
+				}
+
+				// Send the data to the host or only add it to the checksum
+				#if !defined(NO_BLOCK_CRC_SUPPORT)
+				if (Command == AVR109_COMMAND_BlockCRC)
+					Checksum = _crc_xmodem_update(Checksum, Data);
+				else
+				#endif
+				{
+					Endpoint_Write_8(Data);
+					bankTX++;
+				}
 			}
 		}
+
+		#if !defined(NO_BLOCK_CRC_SUPPORT)
+		if (Command == AVR109_COMMAND_BlockCRC)
+		{
+			WriteNextResponseByte(Checksum >> 8);
+			WriteNextResponseByte(Checksum & 0xFF);
+		}
+		#endif
 	}
 	else
 	{
 		uint32_t PageStartAddress = CurrAddress;
 
+		#if !defined(NO_OVERLAPPED_WRITE_SUPPORT)
+		/* The previous page may still be being written, wait before the next SPM or EEPROM access */
+		boot_spm_busy_wait();
+		#endif
+
 		if (MemoryType == MEMORY_TYPE_FLASH)
 		{
+			/* Only whole words are written, anything beyond one page is read but discarded */
+			uint8_t PageBytes = (MIN(BlockSize, SPM_PAGESIZE) & ~1);
+			bool PageChanged = true;
+
+			#if !defined(SKIP_UNCHANGED_PAGES)
+			/* With the page buffer the erase runs while the data is being received, without it the erase has to finish
+			* before the temporary page buffer can be filled */
 			boot_page_erase(PageStartAddress);
+
+			#if defined(NO_OVERLAPPED_WRITE_SUPPORT)
 			boot_spm_busy_wait();
-		}
+			#endif
+			#endif
 
-		while (BlockSize--)
-		{
-			if (MemoryType == MEMORY_TYPE_FLASH)
+			#if !defined(NO_BLOCK_RLE_SUPPORT)
+			if (Command == AVR109_COMMAND_BlockWriteRLE)
 			{
-				/* If both bytes in current word have been written, increment the address counter */
-				if (HighByte)
+				/* Expand the run-length encoded data, see \ref AVR109_COMMAND_BlockWriteRLE for the format */
+				for (uint16_t CurrByte = 0; CurrByte < BlockSize;)
 				{
-					/* Write the next FLASH word to the current FLASH page */
-					boot_page_fill(CurrAddress, ((FetchNextCommandByte() << 8) | LowByte));
+					uint8_t Token = FetchNextCommandByte();
+					uint8_t Count = ((Token & 0x7F) + 1);
+					uint8_t Data  = 0;
+
+					/* A repeated byte is only sent once, literal bytes follow the token one by one */
+					if (Token & 0x80)
+					{
+						Data = FetchNextCommandByte();
+						Count++;
+					}
 
-					/* Increment the address counter after use */
-					CurrAddress += 2;
+					while (Count--)
+					{
+						if (!(Token & 0x80))
+							Data = FetchNextCommandByte();
+
+						StorePageByte(CurrByte++, Data);
+					}
 				}
-				else
+
+				/* A block the host abandons is not written */
+				if (USB_DeviceState == DEVICE_STATE_Unattached)
+				  return true;
+			}
+			else
+			#endif
+			{
+				// The data is read a whole OUT bank at a time, so the endpoint
+				// is only selected and polled once per packet instead of per byte
+				for (uint16_t CurrByte = 0; CurrByte < BlockSize;)
 				{
-					LowByte = FetchNextCommandByte();
+					uint8_t ChunkSize = PrepareCommandBank();
+
+					/* A block the host abandons is not written */
+					if (!(ChunkSize))
+					  return true;
+
+					if (ChunkSize > (BlockSize - CurrByte))
+					  ChunkSize = (BlockSize - CurrByte);
+
+					while (ChunkSize--)
+						StorePageByte(CurrByte++, Endpoint_Read_8());
 				}
+			}
+
+			#if defined(SKIP_UNCHANGED_PAGES)
+			/* Compare the data with the current flash contents, which the erase would destroy, so the erase only starts
+			* once the data has arrived. Erasing and writing the page would leave everything after the data blank, so
+			* that is what the rest of the page is compared to. */
+			boot_rww_enable();
 
-				HighByte = !HighByte;
+			PageChanged = false;
+			for (uint8_t CurrByte = 0; CurrByte < SPM_PAGESIZE; CurrByte++)
+			{
+				#if (FLASHEND > 0xFFFF)
+				uint8_t FlashByte = pgm_read_byte_far(PageStartAddress + CurrByte);
+				#else
+				uint8_t FlashByte = pgm_read_byte(PageStartAddress + CurrByte);
+				#endif
+
+				if (FlashByte != ((CurrByte < PageBytes) ? PageBuffer[CurrByte] : 0xFF))
+					PageChanged = true;
 			}
-			else
+
+			/* An identical page is acknowledged without touching the flash */
+			if (PageChanged)
+				boot_page_erase(PageStartAddress);
+			#endif
+
+			#if !defined(NO_OVERLAPPED_WRITE_SUPPORT)
+			/* Fill the temporary page buffer from RAM once the erase is done */
+			boot_spm_busy_wait();
+
+			if (PageChanged)
+			{
+				for (uint8_t CurrByte = 0; CurrByte < PageBytes; CurrByte += 2)
+					boot_page_fill(PageStartAddress + CurrByte, (PageBuffer[CurrByte + 1] << 8) | PageBuffer[CurrByte]);
+			}
+			#endif
+
+			/* Increment the address counter past the words written */
+			CurrAddress += PageBytes;
+
+			/* Commit the flash page to memory. An overlapped write runs on while the host sends the next command, which
+			* waits for it to finish only if it needs to. */
+			if (PageChanged)
+				boot_page_write(PageStartAddress);
+
+			#if !defined(NO_LAZY_CHIP_ERASE_SUPPORT)
+			/* The page has been erased with its write, or already holds the data */
+			if (PageStartAddress < BOOT_START_ADDR)
+			{
+				uint16_t CurrPage = (PageStartAddress / SPM_PAGESIZE);
+				PagesToErase[CurrPage / 8] &= ~(1 << (CurrPage % 8));
+			}
+			#endif
+
+			#if defined(NO_OVERLAPPED_WRITE_SUPPORT)
+			/* Wait until write operation has completed */
+			boot_spm_busy_wait();
+			#endif
+		}
+		else
+		{
+			while (BlockSize--)
 			{
 				/* Write the next EEPROM byte from the endpoint */
 				eeprom_write_byte((uint8_t*)((intptr_t)(CurrAddress >> 1)), FetchNextCommandByte());
@@ -813,19 +1152,54 @@ static void ReadWriteMemoryBlock(const uint8_t Command)
 			}
 		}
 
-		/* If in FLASH programming mode, commit the page after writing */
-		if (MemoryType == MEMORY_TYPE_FLASH)
-		{
-			/* Commit the flash page to memory */
-			boot_page_write(PageStartAddress);
+		/* Send response byte back to the host */
+		WriteNextResponseByte('\r');
+	}
 
-			/* Wait until write operation has completed */
+	return true;
+}
+
+/** Stores the next byte of the flash page being received by a block write. Bytes beyond the end of the page are
+*  discarded.
+*
+*  \param[in] Offset  Offset of the byte from the start of the page
+*  \param[in] Data    Byte received from the host
+*/
+static void StorePageByte(const uint16_t Offset, const uint8_t Data)
+{
+	if (Offset >= SPM_PAGESIZE)
+	  return;
+
+	#if !defined(NO_OVERLAPPED_WRITE_SUPPORT)
+	PageBuffer[Offset] = Data;
+	#else
+	/* The page has already been erased, so each word goes straight into the temporary page buffer */
+	static uint8_t LowByte;
+
+	if (Offset & 1)
+		boot_page_fill(CurrAddress + Offset - 1, ((Data << 8) | LowByte));
+	else
+		LowByte = Data;
+	#endif
+}
+#endif
+
+#if !defined(NO_LAZY_CHIP_ERASE_SUPPORT)
+/** Erases the application flash pages still marked by a chip erase, see \ref PagesToErase. */
+static void ErasePendingPages(void)
+{
+	for (uint16_t CurrPage = 0; CurrPage < (BOOT_START_ADDR / SPM_PAGESIZE); CurrPage++)
+	{
+		if (PagesToErase[CurrPage / 8] & (1 << (CurrPage % 8)))
+		{
 			boot_spm_busy_wait();
+			boot_page_erase((uint32_t)CurrPage * SPM_PAGESIZE);
 		}
-
-		/* Send response byte back to the host */
-		WriteNextResponseByte('\r');
 	}
+
+	boot_spm_busy_wait();
+	boot_rww_enable();
+	memset(PagesToErase, 0, sizeof(PagesToErase));
 }
 #endif
 
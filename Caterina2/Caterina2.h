@@ -64,6 +64,7 @@ along with Hoodloader2.  If not, see <http://www.gnu.org/licenses/>.
 		#include <avr/power.h>
 		#include <avr/interrupt.h>
 		#include <util/atomic.h>
+		#include <util/crc16.h>
 		#include <stdbool.h>
 
 		#include "Descriptors.h"
@@ -82,6 +83,10 @@ along with Hoodloader2.  If not, see <http://www.gnu.org/licenses/>.
 			#error This bootloader requires that it be optimized for size, not speed, to fit into the target device. Change optimization settings and try again.
 		#endif
 
+		#if defined(SKIP_UNCHANGED_PAGES) && (defined(NO_BLOCK_SUPPORT) || defined(NO_OVERLAPPED_WRITE_SUPPORT))
+			#error SKIP_UNCHANGED_PAGES compares the page buffer of the overlapped block write with the flash. Undefine NO_BLOCK_SUPPORT and NO_OVERLAPPED_WRITE_SUPPORT, or SKIP_UNCHANGED_PAGES.
+		#endif
+
 	/* Macros: */
 		/** Version major of the CDC bootloader. */
 		#define BOOTLOADER_VERSION_MAJOR     0x01
@@ -139,6 +144,18 @@ along with Hoodloader2.  If not, see <http://www.gnu.org/licenses/>.
 			AVR109_COMMAND_SetLED                   = 'x',
 			AVR109_COMMAND_ClearLED                 = 'y',
 			AVR109_COMMAND_ExitBootloader           = 'E',
+			AVR109_COMMAND_BlockCRC                 = 'k', /**< Caterina2 extension. Takes the same arguments as
+			                                                *   \ref AVR109_COMMAND_BlockRead, but returns only the
+			                                                *   CRC16 (XMODEM, big endian) of the block. Left out
+			                                                *   with NO_BLOCK_CRC_SUPPORT. */
+			AVR109_COMMAND_BlockWriteRLE            = 'Z', /**< Caterina2 extension. Takes the same arguments as
+			                                                *   \ref AVR109_COMMAND_BlockWrite with the block size
+			                                                *   giving the decoded size, followed by run-length encoded
+			                                                *   FLASH data. A token byte below 0x80 is followed by
+			                                                *   (token + 1) literal bytes, a token byte from 0x80 is
+			                                                *   followed by one byte that repeats (token - 0x7E) times.
+			                                                *   Runs may not extend past the end of the block. Left
+			                                                *   out with NO_BLOCK_RLE_SUPPORT. */
 		};
 
 	/* Type Defines: */
@@ -158,9 +175,17 @@ along with Hoodloader2.  If not, see <http://www.gnu.org/licenses/>.
 
 		#if defined(INCLUDE_FROM_BOOTLOADERCDC_C) || defined(__DOXYGEN__)
 			#if !defined(NO_BLOCK_SUPPORT)
-			static void    ReadWriteMemoryBlock(const uint8_t Command);
+			static bool    ReadWriteMemoryBlock(const uint8_t Command);
+			static void    StorePageByte(const uint16_t Offset, const uint8_t Data);
+			#endif
+			#if !defined(NO_LAZY_CHIP_ERASE_SUPPORT)
+			static void    ErasePendingPages(void);
 			#endif
+			static bool    ProcessNextCommand(void);
+			static void    RejectCommand(void);
+			static uint8_t PrepareCommandBank(void);
 			static uint8_t FetchNextCommandByte(void);
+			static uint8_t PrepareResponseBank(void);
 			static void    WriteNextResponseByte(const uint8_t Response);
 		#endif
 
@@ -71,4 +71,38 @@ along with Hoodloader2.  If not, see <http://www.gnu.org/licenses/>.
 	#define NO_LOCK_BYTE_WRITE_SUPPORT
 #endif
 
+// Overlapped block writes collect each flash page in a RAM buffer (SPM_PAGESIZE
+// bytes), so that the page erase runs while the data arrives and the page write
+// while the host sends the next command. Not checked against the 4 KB boot
+// section yet, comment out to enable.
+	#define NO_OVERLAPPED_WRITE_SUPPORT
+
+// The Caterina2 'k' block CRC command lets an uploader verify without reading
+// the image back. Not checked against the 4 KB boot section yet, comment out
+// to enable.
+	#define NO_BLOCK_CRC_SUPPORT
+
+// A lazy chip erase only notes which application pages hold data (one bit per
+// page in RAM) and acknowledges at once, the pages are erased when they are
+// written or before flash is read back. Not checked against the 4 KB boot
+// section yet, comment out to enable.
+	#define NO_LAZY_CHIP_ERASE_SUPPORT
+
+// The Caterina2 'Z' run-length encoded block write shortens uploads of images
+// with long runs (see avr109_rle.py). Not checked against the 4 KB boot section
+// yet, comment out to enable.
+	#define NO_BLOCK_RLE_SUPPORT
+
+// Process every AVR109 command the host packed into an OUT packet instead of
+// only the first one, so that a programmer can pipeline its commands. Not
+// checked against the 4 KB boot section yet, comment out to enable.
+	#define NO_PACKED_COMMAND_SUPPORT
+
+// Compare each block written to flash with the current page contents and skip
+// the erase and write if they are identical (speeds up incremental updates).
+// Needs the overlapped block write, but gives up its erase during the data
+// transfer, as the comparison needs the old contents. Not checked against the
+// 4 KB boot section yet, uncomment to enable.
+//	#define SKIP_UNCHANGED_PAGES
+
 #endif
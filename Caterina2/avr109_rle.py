@@ -0,0 +1,191 @@
+#!/usr/bin/env python3
+"""Upload an Intel HEX file to Caterina2 with run-length encoded block writes.
+
+Every page is sent with the 'Z' command, which takes the same arguments as the
+AVR109 'B' block write but expands the data on the device:
+
+    token < 0x80   (token + 1) literal bytes follow
+    token >= 0x80  one byte follows and is repeated (token - 0x7E) times
+
+Once everything is written, a single 'k' block CRC command over the whole
+written range is compared with the CRC of the image padded with 0xFF, so the
+upload is verified without reading it back.
+
+Usage: avr109_rle.py [--dry-run] [--no-rle] [--no-verify] <port> <file.hex>
+
+Both commands are left out of the default build: comment out
+NO_BLOCK_RLE_SUPPORT and NO_BLOCK_CRC_SUPPORT in Config/AppConfig.h to build
+them in. For a bootloader without them, --no-rle sends plain 'B' block writes
+and --no-verify skips the CRC check. The script stops if the bootloader
+answers either command with '?'.
+
+The bootloader has to be running already, e.g. after a 1200 baud touch.
+Requires pyserial unless --dry-run is given, which only prints the sizes.
+"""
+
+import sys
+
+MAX_LITERAL = 0x80
+MAX_RUN = 0xFF - 0x7E
+
+
+def read_hex(path):
+    """Returns the contents of an Intel HEX file as {address: byte}."""
+    data = {}
+    base = 0
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith(':'):
+                continue
+            record = bytes.fromhex(line[1:])
+            if sum(record) & 0xFF:
+                raise ValueError('bad checksum: ' + line)
+            count, address, kind = record[0], (record[1] << 8) | record[2], record[3]
+            payload = record[4:4 + count]
+            if kind == 0x00:
+                for i, b in enumerate(payload):
+                    data[base + address + i] = b
+            elif kind == 0x01:
+                break
+            elif kind == 0x02:
+                base = ((payload[0] << 8) | payload[1]) << 4
+            elif kind == 0x04:
+                base = ((payload[0] << 8) | payload[1]) << 16
+    return data
+
+
+def rle_encode(block):
+    """Encodes one block in the format expanded by the 'Z' command."""
+    out = bytearray()
+    literal = bytearray()
+
+    def flush_literal():
+        while literal:
+            chunk = literal[:MAX_LITERAL]
+            out.append(len(chunk) - 1)
+            out.extend(chunk)
+            del literal[:MAX_LITERAL]
+
+    i = 0
+    while i < len(block):
+        run = 1
+        while i + run < len(block) and run < MAX_RUN and block[i + run] == block[i]:
+            run += 1
+        # A run of two only pays off if it does not split a literal
+        if run >= 3 or (run == 2 and not literal):
+            flush_literal()
+            out.append(run + 0x7E)
+            out.append(block[i])
+            i += run
+        else:
+            literal.append(block[i])
+            i += 1
+    flush_literal()
+    return bytes(out)
+
+
+def crc_xmodem(data):
+    """Same CRC16 as _crc_xmodem_update() on the device."""
+    crc = 0
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def header(block):
+    """Block size and memory type arguments of the 'Z' and 'k' commands."""
+    return bytes((len(block) >> 8, len(block) & 0xFF)) + b'F'
+
+
+def image_range(data, page_size):
+    """Returns (address, block) covering every page that holds data, padded with 0xFF."""
+    start = min(data) - min(data) % page_size
+    end = max(data) - max(data) % page_size + page_size
+    return start, bytes(data.get(a, 0xFF) for a in range(start, end))
+
+
+def pages(data, page_size):
+    """Yields (address, block) for every page that holds data, padded with 0xFF."""
+    for start in sorted({a - a % page_size for a in data}):
+        yield start, bytes(data.get(start + i, 0xFF) for i in range(page_size))
+
+
+class Bootloader:
+    def __init__(self, port):
+        import serial
+        self.port = serial.Serial(port, 57600, timeout=2)
+
+    def command(self, request, response_size=1):
+        self.port.write(request)
+        response = self.port.read(1)
+        if response == b'?' and request[:1] != b'?':
+            raise IOError('command %r is not supported' % request[:1])
+        response += self.port.read(response_size - 1)
+        if len(response) != response_size:
+            raise IOError('no response to %r' % request[:1])
+        return response
+
+    def expect_ack(self, request):
+        if self.command(request) != b'\r':
+            raise IOError('command %r failed' % request[:1])
+
+    def set_address(self, address):
+        # The address is given in words
+        word = address >> 1
+        self.expect_ack(b'A' + bytes((word >> 8, word & 0xFF)))
+
+
+def main(argv):
+    options = ('--dry-run', '--no-rle', '--no-verify')
+    dry_run = '--dry-run' in argv
+    use_rle = '--no-rle' not in argv
+    verify = '--no-verify' not in argv
+    args = [a for a in argv if a not in options]
+    if len(args) != 2:
+        sys.exit(__doc__)
+    port, path = args
+
+    data = read_hex(path)
+    page_size = 128
+
+    if not dry_run:
+        bootloader = Bootloader(port)
+        support = bootloader.command(b'b', 3)
+        if support[:1] != b'Y':
+            sys.exit('bootloader has no block support')
+        page_size = (support[1] << 8) | support[2]
+        bootloader.expect_ack(b'P')
+        bootloader.expect_ack(b'e')
+
+    raw_size = encoded_size = 0
+    for address, block in pages(data, page_size):
+        encoded = rle_encode(block) if use_rle else block
+        raw_size += len(block)
+        encoded_size += len(encoded)
+        if not dry_run:
+            bootloader.set_address(address)
+            bootloader.expect_ack((b'Z' if use_rle else b'B') + header(block) + encoded)
+
+    # Pages between the written ones were blank after the chip erase, so one
+    # CRC over the whole range covers the image
+    if verify and not dry_run and data:
+        address, block = image_range(data, page_size)
+        bootloader.set_address(address)
+        crc = bootloader.command(b'k' + header(block), 2)
+        if (crc[0] << 8) | crc[1] != crc_xmodem(block):
+            sys.exit('verify failed between 0x%04X and 0x%04X' % (address, address + len(block)))
+
+    print('%d bytes in %d bytes (%.0f%%)' %
+          (raw_size, encoded_size, 100.0 * encoded_size / max(raw_size, 1)))
+
+    if not dry_run:
+        bootloader.expect_ack(b'L')
+        bootloader.expect_ack(b'E')
+
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
@@ -37,52 +37,142 @@
  *
  *  Alex Holden <alex@linuxhacker.org>: Ported Arduino changes forward from
  *  LUFA 100807 USBtoSerial to LUFA 151115 USBtoSerial in order to fix data
- *  corruption at 250000 baud. Activity LEDs are now turned off by a timer compare
- *  ISR because we are no longer polling the timer in the main event loop.
+ *  corruption at 250000 baud. Activity LEDs are turned off from the main event
+ *  loop by polling the Timer 0 compare flag, so no timer interrupt competes with
+ *  the USART ISRs.
  */
 
+#define  INCLUDE_FROM_ARDUINO_USBSERIAL_C
 #include "Arduino-usbserial.h"
 
 /** Toggle for WebUSB endpoints enabled from host. */
 extern uint8_t WebUSB_Enabled;
 
+/* NOTE: Both circular buffers live at fixed addresses reserved by the makefile (see RAM_OFFSET),
+ * each aligned to its own size, so their 8-bit indexes simply wrap around with a mask.
+ * One byte is always left free to tell a full buffer from an empty one.
+ * Each index is only written by one side, so no atomic blocks are needed. */
+
 /** Circular buffer to hold data from the host before it is sent to the device via the serial port. */
-static RingBuffer_t USBtoUSART_Buffer;
+#define USBtoUSART_Buffer_Data   ((volatile uint8_t*)USBTOUSART_BUFFER_ADDR)
+#define USBtoUSART_Buffer_Mask   (USBTOUSART_BUFFER_SIZE - 1)
 
-/** Underlying data buffer for \ref USBtoUSART_Buffer, where the stored bytes are located. */
-static uint8_t      USBtoUSART_Buffer_Data[128];
+/** Write (main loop) and read (USART transmit ISR) indexes of \ref USBtoUSART_Buffer_Data. */
+static volatile uint8_t USBtoUSART_In;
+static volatile uint8_t USBtoUSART_Out;
 
 /** Circular buffer to hold data from the serial port before it is sent to the host. */
-static RingBuffer_t USARTtoUSB_Buffer;
+#define USARTtoUSB_Buffer_Data   ((volatile uint8_t*)USARTTOUSB_BUFFER_ADDR)
+#define USARTtoUSB_Buffer_Mask   (USARTTOUSB_BUFFER_SIZE - 1)
 
-/** Underlying data buffer for \ref USARTtoUSB_Buffer, where the stored bytes are located. */
-static uint8_t      USARTtoUSB_Buffer_Data[128];
+/** Write (USART receive ISR) and read (main loop) indexes of \ref USARTtoUSB_Buffer_Data. They are kept in general
+ *  purpose I/O registers (GPIOR0 holds the USB device state), which the receive ISR reaches in a single cycle without
+ *  needing a pointer register.
+ */
+#define USARTtoUSB_In            GPIOR1
+#define USARTtoUSB_Out           GPIOR2
 
-/** Pulse generation counters to keep track of the number of 1/100 second remaining for each pulse type */
-static volatile uint8_t TxLEDPulseTimer;
-static volatile uint8_t RxLEDPulseTimer;
+/** Returns the number of bytes waiting in \ref USBtoUSART_Buffer_Data. */
+static inline uint8_t USBtoUSART_GetCount(void)
+{
+  return ((uint8_t)(USBtoUSART_In - USBtoUSART_Out) & USBtoUSART_Buffer_Mask);
+}
 
-/** Helper function to reset the device when switching between CDC and WebUSB modes */
-void resetDeviceAfterTimeout(int timeout_ms)
-  {
-    /* disable usb and interrupts */
-    USB_Disable();
-    cli(); 
+/** Returns the number of bytes that can still be stored in \ref USBtoUSART_Buffer_Data. */
+static inline uint8_t USBtoUSART_GetFreeCount(void)
+{
+  return (USBtoUSART_Buffer_Mask - USBtoUSART_GetCount());
+}
+
+/** Returns the number of bytes waiting in \ref USARTtoUSB_Buffer_Data. */
+static inline uint8_t USARTtoUSB_GetCount(void)
+{
+  return ((uint8_t)(USARTtoUSB_In - USARTtoUSB_Out) & USARTtoUSB_Buffer_Mask);
+}
 
-    /* wait timeout_ms for usb to properly disconnect and then start the watchdog */
-    Delay_MS(timeout_ms);
-    wdt_enable(WDTO_250MS);
+/** Set when the last packet sent on the CDC data IN endpoint was full, and the transfer must still be terminated. */
+static bool INTransferNeedsZLP;
 
-    /* busy wait until watchdog resets the mcu */
-    while(1);
-  }
+/** Time in units of 100us that a short packet of UART data is held back waiting for more, set by the host. */
+static uint16_t LatencyTimer;
+
+/** Value of \ref GetTimerTick100us() when the latency timer was last restarted. */
+static uint16_t LatencyTimerStart;
+
+/** Character which flushes the UART data to the host as soon as it is received, if \ref EventCharEnabled is set. */
+static uint8_t EventChar;
+static bool    EventCharEnabled;
+
+/** Set by the USART receive ISR when the event character has been received. */
+static volatile bool EventCharReceived;
+
+/** Fill level of \ref USARTtoUSB_Buffer_Data at which CTS to the target is deasserted, 0 if flow control is off. */
+static volatile uint8_t FlowControlHighWater;
+
+/** Set by the host to pack the UART data of each USB frame into as few IN packets as possible, see
+ *  \ref SendDeviceDataPerFrame().
+ */
+static bool FrameMode;
+
+/** Set by the Start of Frame event, and cleared once the main loop has committed the IN bank for that frame. */
+static volatile bool FrameStarted;
+
+/** Baud rate the USART actually runs at, as close to the host's requested rate as the USART clock allows. */
+static uint32_t AchievedBaudRateBPS;
+
+/** Set by the host to discard the data still queued for the target on a line encoding change, rather than send it
+ *  at the old settings first.
+ */
+static bool LineEncodingFlush;
+
+/** Set while a line encoding change waits for the data queued before it to be sent, see \ref ApplyLineEncoding(). */
+static volatile bool LineEncodingPending;
+
+/** Value of \ref MillisecondTicks when the pending line encoding change was requested, and how long it may wait. */
+static uint16_t LineEncodingDrainStart;
+static uint16_t LineEncodingDrainTimeout;
+
+/** USART settings of the pending line encoding change, worked out by the Line Encoding Changed event. */
+static uint32_t PendingBaudRateBPS;
+static uint16_t PendingBaudRateRegister;
+static uint8_t  PendingConfigMask;
+static bool     PendingDoubleSpeed;
+
+/** Set by the USART transmit ISR when it loads the last queued byte and clears TXC1, which is only meaningful after. */
+static volatile bool USARTTxStarted;
+
+/** Set while the USART runs at \ref HIGH_SPEED_BAUD_RATE or above, where the data path trades latency tuning for
+ *  throughput.
+ */
+static bool HighSpeedMode;
+
+/** Irregular CDC_CONTROL_LINE_IN_* signals seen by the USART receive ISR and not yet sent to the host. */
+static volatile uint8_t SerialStateErrors;
+
+/** Set once the header of a SERIAL_STATE notification has been sent and the data packet must follow. */
+static bool SerialStateHeaderSent;
+
+/** Bridge statistics counters. Counters written by the USART receive ISR must be read with interrupts disabled, and
+ *  the main loop updates the others with interrupts disabled so the control request handler never sees them torn.
+ */
+static Bridge_Statistics_t Statistics;
+
+/** Millisecond counter, advanced by the main loop each time Timer 0 reaches its compare match. */
+static uint16_t MillisecondTicks;
+
+/** Pulse generation counters to keep track of the number of milliseconds remaining for each pulse type */
+static uint8_t TxLEDPulseTimer;
+static uint8_t RxLEDPulseTimer;
+
+/** Set by the WebUSB enable request once the new mode has been stored, so the main loop re-enumerates with it. */
+static volatile bool DescriptorSwitchPending;
 
 
 /** LUFA CDC Class driver interface configuration and state information. This structure is
  *  passed to all CDC Class driver functions, so that multiple instances of the same class
  *  within a device can be differentiated from one another.
  */
-const USB_ClassInfo_CDC_Device_t VirtualSerial_CDC_Interface =
+USB_ClassInfo_CDC_Device_t VirtualSerial_CDC_Interface =
   {
     .Config =
       {
@@ -90,14 +180,14 @@ const USB_ClassInfo_CDC_Device_t VirtualSerial_CDC_Interface =
         .DataINEndpoint                 =
           {
             .Address                = CDC_TX_EPADDR,
-            .Size                   = CDC_TXRX_EPSIZE,
-            .Banks                  = 1,
+            .Size                   = CDC_TX_EPSIZE,
+            .Banks                  = CDC_TX_BANK_SIZE,
           },
         .DataOUTEndpoint                =
           {
             .Address                = CDC_RX_EPADDR,
-            .Size                   = CDC_TXRX_EPSIZE,
-            .Banks                  = 1,
+            .Size                   = CDC_RX_EPSIZE,
+            .Banks                  = CDC_RX_BANK_SIZE,
           },
         .NotificationEndpoint           =
           {
@@ -118,62 +208,77 @@ int main(void)
 
   WebUSB_Enabled = eeprom_read_byte((uint8_t *) WEBUSB_ENABLE_BYTE_ADDRESS) & 1;
 
-  RingBuffer_InitBuffer(&USBtoUSART_Buffer, USBtoUSART_Buffer_Data, sizeof(USBtoUSART_Buffer_Data));
-  RingBuffer_InitBuffer(&USARTtoUSB_Buffer, USARTtoUSB_Buffer_Data, sizeof(USARTtoUSB_Buffer_Data));
-
   GlobalInterruptEnable();
 
   for (;;)
   {
-    /* Only try to read in bytes from the CDC interface if the transmit buffer is not full */
-    if (!(RingBuffer_IsFull(&USBtoUSART_Buffer)))
+    /* Switch between the CDC and WebUSB descriptor sets once the host has seen the request complete */
+    if (DescriptorSwitchPending)
+      SwitchDescriptorSet();
+
+    /* Poll the Timer 0 compare flag instead of taking an interrupt, which would delay the USART receive ISR */
+    if (TIFR0 & (1 << OCF0A))
     {
-      int16_t ReceivedByte = CDC_Device_ReceiveByte(&VirtualSerial_CDC_Interface);
+      /* Clear the flag by writing a one to it */
+      TIFR0 = (1 << OCF0A);
+
+      MillisecondTicks++;
 
-      /* Store received byte into the USART transmit buffer */
-      if (!(ReceivedByte < 0))
-        RingBuffer_Insert(&USBtoUSART_Buffer, ReceivedByte);
+      /* Turn off TX/RX LED(s) once the pulse period has elapsed */
+      if (TxLEDPulseTimer && !(--TxLEDPulseTimer))
+        LEDs_TurnOffLEDs(LEDMASK_TX);
+
+      if (RxLEDPulseTimer && !(--RxLEDPulseTimer))
+        LEDs_TurnOffLEDs(LEDMASK_RX);
     }
 
-    uint16_t BufferCount = RingBuffer_GetCount(&USARTtoUSB_Buffer);
-    if (BufferCount)
+    /* Apply a line encoding change once the data queued before it has gone out at the old settings, or it is late */
+    if (LineEncodingPending)
     {
-      Endpoint_SelectEndpoint(VirtualSerial_CDC_Interface.Config.DataINEndpoint.Address);
-
-      /* Check if a packet is already enqueued to the host - if so, we shouldn't try to send more data
-       * until it completes as there is a chance nothing is listening and a lengthy timeout could occur */
-      if (Endpoint_IsINReady())
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
       {
-        /* There is data from the UART waiting to be sent to the host, so switch
-         * the TX LED on and restart the pulse timer: */
-        LEDs_TurnOnLEDs(LEDMASK_TX);
-        TxLEDPulseTimer = TX_RX_LED_PULSE_MS;
+        if (LineEncodingPending && (USARTTxIdle() ||
+            ((uint16_t)(MillisecondTicks - LineEncodingDrainStart) >= LineEncodingDrainTimeout)))
+        {
+          ApplyLineEncoding();
+        }
+      }
+    }
 
-        /* Never send more than one bank size less one byte to the host at a time, so that we don't block
-         * while a Zero Length Packet (ZLP) to terminate the transfer is sent if the host isn't listening */
-        uint8_t BytesToSend = MIN(BufferCount, (CDC_TXRX_EPSIZE - 1));
+    /* Only try to read in bytes from the CDC interface if the transmit buffer is not full */
+    if (USBtoUSART_GetFreeCount())
+      ReceiveHostData();
 
-        /* Read bytes from the USART receive buffer into the USB IN endpoint */
-        while (BytesToSend--)
-        {
-          /* Try to send the next byte of data to the host, abort if there is an error without dequeuing */
-          if (CDC_Device_SendByte(&VirtualSerial_CDC_Interface,
-                      RingBuffer_Peek(&USARTtoUSB_Buffer)) != ENDPOINT_READYWAIT_NoError)
-          {
-            break;
-          }
+    /* Hand any data waiting for the USART to the data register empty ISR, which sends it back-to-back,
+     * unless flow control is on and the target has deasserted its RTS line */
+    if ((USBtoUSART_In != USBtoUSART_Out) && (!(FlowControlHighWater) || !(AVR_RTS_LINE_PIN & AVR_RTS_LINE_MASK)))
+    {
+      LEDs_TurnOnLEDs(LEDMASK_RX);
+      RxLEDPulseTimer = TX_RX_LED_PULSE_MS;
 
-          /* Dequeue the already sent byte from the buffer now we have confirmed that no transmission error occurred */
-          RingBuffer_Remove(&USARTtoUSB_Buffer);
-        }
+      /* UCSR1B is out of reach of the bit instructions, so this is a read-modify-write the transmit ISR must not
+       * interrupt, or its own clearing of UDRIE1 would be undone */
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        UCSR1B |= (1 << UDRIE1);
       }
     }
 
-    /* Load the next byte from the USART transmit buffer into the USART if transmit buffer space is available */
-    if (Serial_IsSendReady() && !(RingBuffer_IsEmpty(&USBtoUSART_Buffer))) {
-        LEDs_TurnOnLEDs(LEDMASK_RX);
-        RxLEDPulseTimer = TX_RX_LED_PULSE_MS;
-        Serial_SendByte(RingBuffer_Remove(&USBtoUSART_Buffer));
+    /* Forward data from the UART to the host, filling any free IN bank */
+    if (FrameMode || FrameStarted)
+      SendDeviceDataPerFrame();
+    else
+      SendDeviceData();
+
+    /* Tell the host about any data lost on the way in */
+    if (SerialStateErrors || SerialStateHeaderSent)
+      SendSerialState();
+
+    /* Let the target send again once the buffer has drained below the high-water mark */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      if (FlowControlHighWater && (USARTtoUSB_GetCount() < FlowControlHighWater))
+        AVR_CTS_LINE_PORT &= ~AVR_CTS_LINE_MASK;
     }
 
     CDC_Device_USBTask(&VirtualSerial_CDC_Interface);
@@ -181,6 +286,340 @@ int main(void)
   }
 }
 
+/** Detaches from the host, swaps the descriptor set returned by \ref CALLBACK_USB_GetDescriptor() for the mode stored in
+ *  EEPROM and attaches again, so the host enumerates the device afresh as the other one of its two identities. Only
+ *  the USB interface is restarted, the USART and the target keep running.
+ */
+static void SwitchDescriptorSet(void)
+{
+  DescriptorSwitchPending = false;
+
+  /* The zero length status packet of the request may still be waiting in the control endpoint. Let the host collect
+   * it first, or the request fails on the host side instead of being followed by a clean disconnect. */
+  Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
+
+  for (uint16_t Timeout = (USB_STATUS_STAGE_TIMEOUT_MS * 10); Timeout && !(Endpoint_IsINReady()); Timeout--)
+    _delay_us(100);
+
+  USB_Disable();
+  USB_DeviceState = DEVICE_STATE_Unattached;
+
+  /* Stay detached long enough for the host to see the device go away */
+  Delay_MS(USB_DETACH_TIME_MS);
+
+  WebUSB_Enabled = eeprom_read_byte((uint8_t *) WEBUSB_ENABLE_BYTE_ADDRESS) & 1;
+
+  /* Attaches again, the endpoints are reconfigured once the host has set the configuration */
+  USB_Init();
+}
+
+/** Moves as much of the current CDC data OUT bank as will fit into \ref USBtoUSART_Buffer_Data in a single pass,
+ *  releasing the bank back to the host as soon as it has been emptied. Unlike \c CDC_Device_ReceiveByte(), the
+ *  endpoint is only selected and checked once per packet rather than once per byte.
+ */
+static void ReceiveHostData(void)
+{
+  /* Host data sent after a line encoding change stays in the endpoint until the change has been applied */
+  if ((USB_DeviceState != DEVICE_STATE_Configured) || !(VirtualSerial_CDC_Interface.State.LineEncoding.BaudRateBPS) ||
+      LineEncodingPending)
+  {
+    return;
+  }
+
+  Endpoint_SelectEndpoint(VirtualSerial_CDC_Interface.Config.DataOUTEndpoint.Address);
+
+  /* Count the passes in which the host had to be turned away because both OUT banks were still full. The flag is
+   * cleared by writing zero, and writing ones to the other bits of UEINTX leaves them untouched. */
+  if (UEINTX & (1 << NAKOUTI))
+  {
+    UEINTX = (uint8_t)~(1 << NAKOUTI);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      Statistics.OUTNAKs++;
+    }
+  }
+
+  /* With a double banked endpoint the next packet may already be waiting once the current bank is released */
+  while (Endpoint_IsOUTReceived())
+  {
+    /* Never take more bytes from the bank than the USART transmit buffer can hold, the rest stays queued */
+    uint8_t BytesToReceive = MIN(Endpoint_BytesInEndpoint(), USBtoUSART_GetFreeCount());
+    uint8_t In             = USBtoUSART_In;
+
+    for (uint8_t i = BytesToReceive; i; i--)
+    {
+      USBtoUSART_Buffer_Data[In] = Endpoint_Read_8();
+      In = ((In + 1) & USBtoUSART_Buffer_Mask);
+    }
+
+    /* Hand the new data to the USART transmit ISR in one go */
+    USBtoUSART_In = In;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      Statistics.USBtoUSARTBytes += BytesToReceive;
+
+      if (USBtoUSART_GetCount() > Statistics.USBtoUSARTHighWater)
+        Statistics.USBtoUSARTHighWater = USBtoUSART_GetCount();
+    }
+
+    if (Endpoint_BytesInEndpoint())
+      break;
+
+    /* Free the bank for the next packet once all of its data has been read (this also acknowledges ZLPs) */
+    Endpoint_ClearOUT();
+  }
+}
+
+/** Moves data from \ref USARTtoUSB_Buffer_Data into the CDC data IN endpoint. Each free bank is filled and handed to the
+ *  host in turn, so that with a double banked endpoint the next packet is built while the previous one is in flight.
+ */
+static void SendDeviceData(void)
+{
+  if ((USB_DeviceState != DEVICE_STATE_Configured) || !(VirtualSerial_CDC_Interface.State.LineEncoding.BaudRateBPS))
+    return;
+
+  /* At high speed a full packet arrives within a few hundred microseconds, so holding data back only risks overflowing
+   * the ring buffer - send whatever is there as soon as a bank is free */
+  uint16_t Latency = (HighSpeedMode ? 0 : LatencyTimer);
+
+  /* While there is nothing to send keep restarting the latency timer, so it runs from the arrival of the next byte */
+  if (Latency && !(USARTtoUSB_GetCount()))
+    LatencyTimerStart = GetTimerTick100us();
+
+  Endpoint_SelectEndpoint(VirtualSerial_CDC_Interface.Config.DataINEndpoint.Address);
+
+  /* Only write to a free bank - if both banks are still queued to the host we shouldn't try to send more data
+   * until one completes as there is a chance nothing is listening and a lengthy timeout could occur */
+  while (Endpoint_IsINReady())
+  {
+    uint8_t  BufferCount;
+    bool     FlushEventChar;
+
+    /* Take the count and the event character flag together, so that an event character the ISR adds after the
+     * count is not cleared along with the data counted here. The event character has been flushed once everything
+     * up to it goes out in this packet. */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      BufferCount    = USARTtoUSB_GetCount();
+      FlushEventChar = EventCharReceived;
+
+      if (BufferCount <= CDC_TX_EPSIZE)
+        EventCharReceived = false;
+    }
+
+    /* The buffer is at its fullest just before it is emptied into the endpoint */
+    if (BufferCount > Statistics.USARTtoUSBHighWater)
+    {
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        Statistics.USARTtoUSBHighWater = BufferCount;
+      }
+    }
+
+    if (!(BufferCount))
+    {
+      /* The last packet was full and nothing followed it, so end the transfer with a Zero Length Packet (ZLP)
+       * to stop the host waiting for more data. The bank is free, so this never blocks. */
+      if (INTransferNeedsZLP)
+      {
+        Endpoint_ClearIN();
+        INTransferNeedsZLP = false;
+      }
+
+      break;
+    }
+
+    /* Hold back a short packet until the latency timer expires, unless the event character asks for a flush */
+    if (Latency && (BufferCount < CDC_TX_EPSIZE) && !(FlushEventChar) &&
+        ((uint16_t)(GetTimerTick100us() - LatencyTimerStart) < Latency))
+    {
+      break;
+    }
+
+    /* There is data from the UART waiting to be sent to the host, so switch
+     * the TX LED on and restart the pulse timer: */
+    LEDs_TurnOnLEDs(LEDMASK_TX);
+    TxLEDPulseTimer = TX_RX_LED_PULSE_MS;
+
+    uint8_t BytesToSend = MIN(BufferCount, CDC_TX_EPSIZE);
+
+    /* A full packet does not end the transfer - it needs either more data or a ZLP after it */
+    INTransferNeedsZLP = (BytesToSend == CDC_TX_EPSIZE);
+
+    uint8_t Out = USARTtoUSB_Out;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      Statistics.USARTtoUSBBytes += BytesToSend;
+      Statistics.INPackets++;
+    }
+
+    /* Read bytes from the USART receive buffer into the USB IN endpoint */
+    while (BytesToSend--)
+    {
+      Endpoint_Write_8(USARTtoUSB_Buffer_Data[Out]);
+      Out = ((Out + 1) & USARTtoUSB_Buffer_Mask);
+    }
+
+    /* Release the space to the USART receive ISR in one go */
+    USARTtoUSB_Out = Out;
+
+    Endpoint_ClearIN();
+
+    /* Any data left over waits for a full latency period of its own */
+    if (Latency)
+      LatencyTimerStart = GetTimerTick100us();
+  }
+}
+
+/** Moves data from \ref USARTtoUSB_Buffer_Data into the CDC data IN endpoint like \ref SendDeviceData(), but keeps
+ *  adding to the current bank and only hands it to the host when it is full, or when the next USB frame starts. A
+ *  burst arriving within one frame then goes out as one packet instead of several short ones, which cuts the number
+ *  of transfers the host has to complete. The latency timer does not apply, the event character still flushes.
+ */
+static void SendDeviceDataPerFrame(void)
+{
+  if ((USB_DeviceState != DEVICE_STATE_Configured) || !(VirtualSerial_CDC_Interface.State.LineEncoding.BaudRateBPS))
+    return;
+
+  Endpoint_SelectEndpoint(VirtualSerial_CDC_Interface.Config.DataINEndpoint.Address);
+
+  if (!(Endpoint_IsINReady()))
+    return;
+
+  uint8_t BytesInBank = Endpoint_BytesInEndpoint();
+  uint8_t BufferCount;
+  bool    FlushEventChar;
+
+  /* Take the count and the event character flag together, as in SendDeviceData(). The event character has been
+   * flushed once everything up to it is in the bank. */
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    BufferCount    = USARTtoUSB_GetCount();
+    FlushEventChar = EventCharReceived;
+
+    if (BufferCount <= (CDC_TX_EPSIZE - BytesInBank))
+      EventCharReceived = false;
+  }
+
+  uint8_t BytesToSend = MIN(BufferCount, (CDC_TX_EPSIZE - BytesInBank));
+  bool    FlushBank   = (FrameStarted || (FlushEventChar && (BytesToSend == BufferCount)));
+
+  if (BufferCount > Statistics.USARTtoUSBHighWater)
+  {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      Statistics.USARTtoUSBHighWater = BufferCount;
+    }
+  }
+
+  if (BytesToSend)
+  {
+    LEDs_TurnOnLEDs(LEDMASK_TX);
+    TxLEDPulseTimer = TX_RX_LED_PULSE_MS;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      Statistics.USARTtoUSBBytes += BytesToSend;
+    }
+
+    BytesInBank += BytesToSend;
+
+    uint8_t Out = USARTtoUSB_Out;
+
+    while (BytesToSend--)
+    {
+      Endpoint_Write_8(USARTtoUSB_Buffer_Data[Out]);
+      Out = ((Out + 1) & USARTtoUSB_Buffer_Mask);
+    }
+
+    USARTtoUSB_Out = Out;
+  }
+
+  /* Commit a full bank straight away, anything else waits for the next frame. A ZLP still follows a full packet that
+   * nothing else came after, one frame later. */
+  if ((BytesInBank == CDC_TX_EPSIZE) || (FlushBank && (BytesInBank || INTransferNeedsZLP)))
+  {
+    INTransferNeedsZLP = (BytesInBank == CDC_TX_EPSIZE);
+
+    if (BytesInBank)
+    {
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        Statistics.INPackets++;
+      }
+    }
+
+    Endpoint_ClearIN();
+  }
+
+  /* Only the frame's first pass with a free bank flushes, later data waits for the next frame */
+  if (FlushBank)
+    FrameStarted = false;
+}
+
+/** Reports the errors collected in \ref SerialStateErrors to the host with a CDC SERIAL_STATE notification. The 10 byte
+ *  notification does not fit the notification endpoint, so the header and the data go out in two packets, each sent
+ *  on a later pass once the previous one has been collected so that the main loop never waits for the host.
+ */
+static void SendSerialState(void)
+{
+  if (USB_DeviceState != DEVICE_STATE_Configured)
+    return;
+
+  Endpoint_SelectEndpoint(VirtualSerial_CDC_Interface.Config.NotificationEndpoint.Address);
+
+  if (!(Endpoint_IsINReady()))
+    return;
+
+  if (!(SerialStateHeaderSent))
+  {
+    Endpoint_Write_8(REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE);
+    Endpoint_Write_8(CDC_NOTIF_SerialState);
+    Endpoint_Write_16_LE(0);
+    Endpoint_Write_16_LE(VirtualSerial_CDC_Interface.Config.ControlInterfaceNumber);
+    Endpoint_Write_16_LE(sizeof(uint16_t));
+    Endpoint_ClearIN();
+
+    SerialStateHeaderSent = true;
+  }
+  else
+  {
+    uint8_t Errors;
+
+    /* Errors seen while the header was in flight are reported too, later ones start a new notification */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      Errors            = SerialStateErrors;
+      SerialStateErrors = 0;
+    }
+
+    /* The error bits are one-shot events, the host driver clears them again on its side */
+    Endpoint_Write_16_LE(VirtualSerial_CDC_Interface.State.ControlLineStates.DeviceToHost | Errors);
+    Endpoint_ClearIN();
+
+    SerialStateHeaderSent = false;
+  }
+}
+
+/** Returns the current time in units of 100us, made up of the Timer 0 millisecond tick and the timer's counter.
+ *  The value wraps around, so it should only be used for measuring intervals shorter than 6.5 seconds. Must only be
+ *  called from the main loop, which owns \ref MillisecondTicks.
+ */
+static uint16_t GetTimerTick100us(void)
+{
+  uint16_t Milliseconds = MillisecondTicks;
+  uint8_t  Counter      = TCNT0;
+
+  /* Account for a compare match that has wrapped the counter but has not been counted by the main loop yet */
+  if ((TIFR0 & (1 << OCF0A)) && (Counter < (OCR0A / 2)))
+    Milliseconds++;
+
+  /* Timer 0 counts at 250KHz, so 25 counts make up 100us */
+  return (Milliseconds * 10) + (Counter / 25);
+}
+
 /** Configures the board hardware and chip peripherals for the demo's functionality. */
 void SetupHardware(void)
 {
@@ -198,14 +637,14 @@ void SetupHardware(void)
   LEDs_Init();
   USB_Init();
 
-  /* Set up Timer 0 to give us a compare match interrupt at 1KHz so we can
-   * turn off the TX/RX LEDs in the after an appropriate number of ms to
-   * make the pulses visible. NB. 16MHz with /64 prescaler = 250KHz. */
+  /* Set up Timer 0 to reach a compare match at 1KHz, polled by the main loop so we can
+   * turn off the TX/RX LEDs after an appropriate number of ms to make the pulses
+   * visible. No interrupt is enabled, so nothing competes with the USART ISRs.
+   * NB. 16MHz with /64 prescaler = 250KHz. */
   TCCR0B = (1 << CS01 | 1 << CS00);
   TCCR0A = 1 << WGM01;
   TCNT0 = 0;
   OCR0A = 249;
-  TIMSK0 = (1 << OCIE0A);
 
   /* Pull target /RESET line high */
   AVR_RESET_LINE_PORT |= AVR_RESET_LINE_MASK;
@@ -215,9 +654,30 @@ void SetupHardware(void)
 /** Event handler for the library USB Configuration Changed event. */
 void EVENT_USB_Device_ConfigurationChanged(void)
 {
+  INTransferNeedsZLP    = false;
+  SerialStateHeaderSent = false;
+
+  /* A bus reset disables the Start of Frame interrupt again */
+  if (FrameMode)
+    USB_Device_EnableSOFEvents();
+
   CDC_Device_ConfigureEndpoints(&VirtualSerial_CDC_Interface);
 }
 
+/** Event handler for the library USB Start of Frame event, enabled while \ref FrameMode is set. Only flags the new
+ *  frame, the IN endpoint is committed by the main loop.
+ */
+void EVENT_USB_Device_StartOfFrame(void)
+{
+  FrameStarted = true;
+}
+
+/** Event handler for the library USB Reset event. Alternate enumeration only lasts until the device is reset. */
+void EVENT_USB_Device_Reset(void)
+{
+  MS_OS_20_AltEnumeration = 0;
+}
+
 /** Event handler for the USB_Disconnect event. This indicates the device is no longer connected to the host and the
  *  device should revert to default interfaces.
  */
@@ -350,6 +810,26 @@ void EVENT_USB_Device_ControlRequest(void)
                   break;
               }
               break;
+            case Bridge_RTYPE_GetStatistics:
+            {
+              Bridge_Statistics_t StatisticsCopy;
+
+              /* Take a consistent snapshot, the counters keep running while the host reads it */
+              ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+              {
+                StatisticsCopy = Statistics;
+              }
+
+              Endpoint_ClearSETUP();
+              Endpoint_Write_Control_Stream_LE(&StatisticsCopy, sizeof(StatisticsCopy));
+              Endpoint_ClearStatusStage();
+              break;
+            }
+            case Bridge_RTYPE_GetBaudRate:
+              Endpoint_ClearSETUP();
+              Endpoint_Write_Control_Stream_LE(&AchievedBaudRateBPS, sizeof(AchievedBaudRateBPS));
+              Endpoint_ClearStatusStage();
+              break;
             default:    /* Stall on unknown WebUSB request */
               Endpoint_StallTransaction();
               break;
@@ -360,7 +840,7 @@ void EVENT_USB_Device_ControlRequest(void)
             case MS_OS_20_DESCRIPTOR_INDEX:
                             Endpoint_ClearSETUP();
               /* Write the descriptor data to the control endpoint */
-              if (WebUSB_Enabled) {
+              if (WebUSB_Enabled || MS_OS_20_AltEnumeration) {
                                 Endpoint_Write_Control_PStream_LE(&MS_OS_20_Descriptor_WebUSB, MS_OS_20_Descriptor_WebUSB.Header.TotalLength);
               } else {
                                 Endpoint_Write_Control_PStream_LE(&MS_OS_20_Descriptor, MS_OS_20_Descriptor.Header.TotalLength);
@@ -368,15 +848,6 @@ void EVENT_USB_Device_ControlRequest(void)
               /* Release the endpoint after transaction. */
                             Endpoint_ClearStatusStage();
               break;
-            case MS_OS_20_SET_ALT_ENUMERATION:
-              switch (USB_ControlRequest.wValue) {
-                case (MS_OS_20_ALTERNATE_ENUMERATION_CODE << 8):	// High byte
-                                    Endpoint_ClearSETUP();
-                  // Do something with alternate interface settings
-                                    break;
-                                default:	/* Unknown AltEnumCode */
-                                    Endpoint_StallTransaction();
-              }
             default:    /* Stall on unknown MS OS 2.0 request */
               Endpoint_StallTransaction();
               break;
@@ -392,22 +863,84 @@ void EVENT_USB_Device_ControlRequest(void)
             switch (USB_ControlRequest.bRequest) {
                 case WEBUSB_VENDOR_CODE:
                     switch (USB_ControlRequest.wIndex) {
+                        case Bridge_RTYPE_SetLatencyTimer:
+                            Endpoint_ClearSETUP();
+                            LatencyTimer = USB_ControlRequest.wValue;
+                            Endpoint_ClearStatusStage();
+                            break;
+                        case Bridge_RTYPE_SetEventChar:
+                            Endpoint_ClearSETUP();
+                            EventChar        = (USB_ControlRequest.wValue & 0xFF);
+                            EventCharEnabled = ((USB_ControlRequest.wValue >> 8) & 1);
+                            Endpoint_ClearStatusStage();
+                            break;
+                        case Bridge_RTYPE_SetFlowControl:
+                            Endpoint_ClearSETUP();
+                            SetFlowControl(MIN(USB_ControlRequest.wValue, USARTtoUSB_Buffer_Mask));
+                            Endpoint_ClearStatusStage();
+                            break;
+                        case Bridge_RTYPE_SetFrameMode:
+                            Endpoint_ClearSETUP();
+                            FrameMode = (USB_ControlRequest.wValue & 1);
+                            if (FrameMode)
+                            {
+                              USB_Device_EnableSOFEvents();
+                            }
+                            else
+                            {
+                              /* One last per-frame pass commits whatever is left in the current bank */
+                              USB_Device_DisableSOFEvents();
+                              FrameStarted = true;
+                            }
+                            Endpoint_ClearStatusStage();
+                            break;
+                        case Bridge_RTYPE_SetLineEncodingFlush:
+                            Endpoint_ClearSETUP();
+                            LineEncodingFlush = (USB_ControlRequest.wValue & 1);
+                            Endpoint_ClearStatusStage();
+                            break;
+                        case Bridge_RTYPE_ResetStatistics:
+                            Endpoint_ClearSETUP();
+                            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+                            {
+                                memset(&Statistics, 0, sizeof(Statistics));
+                            }
+                            Endpoint_ClearStatusStage();
+                            break;
                         case WebUSB_RTYPE_Enable:
                             Endpoint_ClearSETUP();
-                            /* Update state, if necessary */
-                            if (WebUSB_Enabled != USB_ControlRequest.wValue & 1) {
-                                WebUSB_Enabled = USB_ControlRequest.wValue & 1;
-                                eeprom_write_byte((uint8_t *) WEBUSB_ENABLE_BYTE_ADDRESS, WebUSB_Enabled);
+                            /* Update state, if necessary. The main loop re-enumerates after the status stage. */
+                            if (WebUSB_Enabled != (USB_ControlRequest.wValue & 1)) {
+                                eeprom_write_byte((uint8_t *) WEBUSB_ENABLE_BYTE_ADDRESS, USB_ControlRequest.wValue & 1);
+                                DescriptorSwitchPending = true;
+                            }
+                            Endpoint_ClearStatusStage();
+                            break;
+                        default:    /* Stall on unknown MS OS 2.0 request */
+                            Endpoint_StallTransaction();
+                            break;
+                    }
+                    break;
+#if (MS_OS_20_ALTERNATE_ENUMERATION_CODE != 0)
+                case MS_OS_20_VENDOR_CODE:
+                    switch (USB_ControlRequest.wIndex) {
+                        case MS_OS_20_SET_ALT_ENUMERATION:
+                            /* Windows asks for the alternate descriptor set by its code, in the high byte */
+                            if ((USB_ControlRequest.wValue >> 8) == MS_OS_20_ALTERNATE_ENUMERATION_CODE) {
+                                Endpoint_ClearSETUP();
+                                /* Windows reads the descriptors again, and gets the WebUSB set until the next bus reset */
+                                MS_OS_20_AltEnumeration = 1;
                                 Endpoint_ClearStatusStage();
-                                resetDeviceAfterTimeout(2000);
                             } else {
-                                Endpoint_ClearStatusStage();
+                                Endpoint_StallTransaction();
                             }
+                            break;
                         default:    /* Stall on unknown MS OS 2.0 request */
                             Endpoint_StallTransaction();
                             break;
                     }
                     break;
+#endif
                 default:    /* Stall on unknown bRequest / Vendor Code */
                     Endpoint_StallTransaction();
                     break;
@@ -419,27 +952,186 @@ void EVENT_USB_Device_ControlRequest(void)
   }
 }
 
-/** ISR to turn off the TX/RX LEDs after an appropriate delay. */
-ISR(TIMER0_COMPA_vect)
-{
-  if (TxLEDPulseTimer && !(--TxLEDPulseTimer))
-    LEDs_TurnOffLEDs(LEDMASK_TX);
-
-  /* Turn off RX LED(s) once the RX pulse period has elapsed */
-  if (RxLEDPulseTimer && !(--RxLEDPulseTimer))
-    LEDs_TurnOffLEDs(LEDMASK_RX);
-}
-
 /** ISR to manage the reception of data from the serial port, placing received bytes into a circular buffer
  *  for later transmission to the host.
  */
 ISR(USART1_RX_vect, ISR_BLOCK)
 {
+  /* The error flags belong to the byte at the head of the receive FIFO, so they must be read before UDR1 */
+  uint8_t Status       = UCSR1A;
   uint8_t ReceivedByte = UDR1;
+  uint8_t In           = USARTtoUSB_In;
+  uint8_t NextIn       = ((In + 1) & USARTtoUSB_Buffer_Mask);
+
+  /* In high speed mode a byte arrives every 80 to 160 cycles, so a clean byte that fits is stored and the ISR left at
+   * once. The main loop ignores the event character at these rates, and errors and drops take the full path below. */
+  if (HighSpeedMode && !(Status & ((1 << FE1) | (1 << UPE1) | (1 << DOR1))) && (NextIn != USARTtoUSB_Out) &&
+      (USB_DeviceState == DEVICE_STATE_Configured))
+  {
+    USARTtoUSB_Buffer_Data[In] = ReceivedByte;
+    USARTtoUSB_In = NextIn;
+
+    if (FlowControlHighWater && (USARTtoUSB_GetCount() >= FlowControlHighWater))
+      AVR_CTS_LINE_PORT |= AVR_CTS_LINE_MASK;
+
+    return;
+  }
+
+  if (Status & ((1 << FE1) | (1 << UPE1) | (1 << DOR1)))
+  {
+    if (Status & (1 << FE1))
+    {
+      Statistics.FramingErrors++;
+      SerialStateErrors |= CDC_CONTROL_LINE_IN_FRAMEERROR;
+    }
+
+    if (Status & (1 << UPE1))
+    {
+      Statistics.ParityErrors++;
+      SerialStateErrors |= CDC_CONTROL_LINE_IN_PARITYERROR;
+    }
+
+    if (Status & (1 << DOR1))
+    {
+      Statistics.DataOverruns++;
+      SerialStateErrors |= CDC_CONTROL_LINE_IN_OVERRUNERROR;
+    }
+  }
 
   /* Drop incoming data if the USB device isn't configured or the ring buffer is already full. */
-  if ((USB_DeviceState == DEVICE_STATE_Configured) && !(RingBuffer_IsFull(&USARTtoUSB_Buffer)))
-    RingBuffer_Insert(&USARTtoUSB_Buffer, ReceivedByte);
+  if (USB_DeviceState != DEVICE_STATE_Configured)
+  {
+    Statistics.DroppedUnconfigured++;
+  }
+  else if (NextIn == USARTtoUSB_Out)
+  {
+    Statistics.DroppedFull++;
+    SerialStateErrors |= CDC_CONTROL_LINE_IN_OVERRUNERROR;
+  }
+  else
+  {
+    USARTtoUSB_Buffer_Data[In] = ReceivedByte;
+    USARTtoUSB_In = NextIn;
+  }
+
+  /* Ask the target to pause by deasserting CTS once the buffer reaches the high-water mark */
+  if (FlowControlHighWater && (USARTtoUSB_GetCount() >= FlowControlHighWater))
+    AVR_CTS_LINE_PORT |= AVR_CTS_LINE_MASK;
+
+  /* Ask the main loop to flush everything up to the event character to the host without waiting */
+  if (EventCharEnabled && (ReceivedByte == EventChar))
+    EventCharReceived = true;
+}
+
+/** ISR to load the next byte from \ref USBtoUSART_Buffer_Data into the USART as soon as its data register is empty, so
+ *  that host data is sent at line rate no matter what the main loop is busy with. The interrupt is enabled by the
+ *  main loop whenever the buffer holds data, and disables itself once the buffer has been emptied.
+ */
+ISR(USART1_UDRE_vect, ISR_BLOCK)
+{
+  uint8_t Out = USBtoUSART_Out;
+
+  /* Pause as soon as the target deasserts RTS, the main loop resumes once it is asserted again */
+  if (FlowControlHighWater && (AVR_RTS_LINE_PIN & AVR_RTS_LINE_MASK))
+  {
+    UCSR1B &= ~(1 << UDRIE1);
+    return;
+  }
+
+  /* The main loop may re-enable the interrupt just after the last byte was sent, so check before removing */
+  if (Out != USBtoUSART_In)
+  {
+    UDR1 = USBtoUSART_Buffer_Data[Out];
+    USBtoUSART_Out = Out = ((Out + 1) & USBtoUSART_Buffer_Mask);
+
+    /* Restart the transmit complete flag with the last byte, so that DrainUSART() can tell when it has gone out */
+    if (Out == USBtoUSART_In)
+    {
+      UCSR1A = ((UCSR1A & (1 << U2X1)) | (1 << TXC1));
+      USARTTxStarted = true;
+    }
+  }
+
+  if (Out == USBtoUSART_In)
+    UCSR1B &= ~(1 << UDRIE1);
+}
+
+/** Enables or disables RTS/CTS hardware flow control with the target.
+ *
+ *  \param[in] HighWater  Fill level of \ref USARTtoUSB_Buffer_Data at which CTS is deasserted, 0 to disable flow control
+ */
+static void SetFlowControl(const uint8_t HighWater)
+{
+  FlowControlHighWater = HighWater;
+
+  if (HighWater)
+  {
+    /* Drive CTS (active low), and pull RTS up so an unconnected line reads as deasserted */
+    AVR_CTS_LINE_PORT &= ~AVR_CTS_LINE_MASK;
+    AVR_CTS_LINE_DDR  |= AVR_CTS_LINE_MASK;
+    AVR_RTS_LINE_PORT |= AVR_RTS_LINE_MASK;
+  }
+  else
+  {
+    /* Release both lines */
+    AVR_CTS_LINE_DDR  &= ~AVR_CTS_LINE_MASK;
+    AVR_CTS_LINE_PORT &= ~AVR_CTS_LINE_MASK;
+    AVR_RTS_LINE_PORT &= ~AVR_RTS_LINE_MASK;
+  }
+}
+
+/** Tells whether everything queued for the target has left the USART, so that a line encoding change neither cuts it
+ *  short nor sends it at the new settings.
+ *
+ *  \return Boolean \c true if the USART has nothing left to send, or its transmitter is off
+ */
+static bool USARTTxIdle(void)
+{
+  if (!(UCSR1B & (1 << TXEN1)))
+    return true;
+
+  return ((USBtoUSART_In == USBtoUSART_Out) && (!(USARTTxStarted) || (UCSR1A & (1 << TXC1))));
+}
+
+/** Finds the USART settings that come closest to the requested baud rate, trying both normal mode (16 samples per bit)
+ *  and double speed mode (8 samples per bit).
+ *
+ *  \param[in]  BaudRateBPS  Requested baud rate, must not be zero
+ *  \param[out] DoubleSpeed  Set if the USART must run in double speed (U2X) mode
+ *  \param[out] AchievedBPS  Baud rate produced by the returned settings, rounded to the nearest integer
+ *
+ *  \return UBRR value giving the lowest baud rate error
+ */
+static uint16_t SolveBaudRate(const uint32_t BaudRateBPS, bool* const DoubleSpeed, uint32_t* const AchievedBPS)
+{
+  uint16_t BestRegister = 0;
+  uint32_t BestError    = UINT32_MAX;
+
+  /* Normal mode is tried first and kept on a tie, as its extra samples per bit make the receiver more tolerant */
+  for (uint8_t SamplesPerBit = 16; SamplesPerBit >= 8; SamplesPerBit /= 2)
+  {
+    uint32_t SampleClock = (F_CPU / SamplesPerBit);
+    uint32_t Divider     = ((SampleClock + (BaudRateBPS / 2)) / BaudRateBPS);
+
+    /* UBRR is 12 bits wide and holds the divider minus one */
+    if (Divider < 1)
+      Divider = 1;
+    else if (Divider > 4096)
+      Divider = 4096;
+
+    uint32_t Achieved = ((SampleClock + (Divider / 2)) / Divider);
+    uint32_t Error    = ((Achieved > BaudRateBPS) ? (Achieved - BaudRateBPS) : (BaudRateBPS - Achieved));
+
+    if (Error < BestError)
+    {
+      BestError    = Error;
+      BestRegister = (Divider - 1);
+      *DoubleSpeed = (SamplesPerBit == 8);
+      *AchievedBPS = Achieved;
+    }
+  }
+
+  return BestRegister;
 }
 
 /** Event handler for the CDC Class driver Line Encoding Changed event.
@@ -476,27 +1168,93 @@ void EVENT_CDC_Device_LineEncodingChanged(USB_ClassInfo_CDC_Device_t* const CDCI
       break;
   }
 
-  /* Keep the TX line held high (idle) while the USART is reconfigured */
-  PORTD |= (1 << 3);
+  bool     DoubleSpeed      = false;
+  uint16_t BaudRateRegister = 0;
+  uint32_t BaudRateBPS      = CDCInterfaceInfo->State.LineEncoding.BaudRateBPS;
+
+  /* Special case 57600 baud for compatibility with the ATmega328 bootloader, whose own baud rate error it matches. */
+  if (BaudRateBPS == 57600)
+  {
+    BaudRateRegister = SERIAL_UBBRVAL(57600);
+    BaudRateBPS      = (((F_CPU / 16) + ((BaudRateRegister + 1) / 2)) / (BaudRateRegister + 1));
+  }
+  else if (BaudRateBPS)
+  {
+    BaudRateRegister = SolveBaudRate(BaudRateBPS, &DoubleSpeed, &BaudRateBPS);
+  }
+
+  /* Hosts often repeat the current settings, e.g. when the port is opened, so leave a running USART alone then. This
+   * also cancels a change that has not been applied yet. */
+  if (BaudRateBPS && (UCSR1B & (1 << RXEN1)) && (UBRR1 == BaudRateRegister) && (UCSR1C == ConfigMask) &&
+      (!(UCSR1A & (1 << U2X1)) == !(DoubleSpeed)))
+  {
+    LineEncodingPending = false;
+    return;
+  }
+
+  PendingBaudRateBPS      = BaudRateBPS;
+  PendingBaudRateRegister = BaudRateRegister;
+  PendingConfigMask       = ConfigMask;
+  PendingDoubleSpeed      = DoubleSpeed;
+  LineEncodingPending     = true;
+
+  /* The data queued for the target is sent at the old settings first, unless the host asked for it to be discarded.
+   * Waiting for it here would hold up the control request and with it the main loop and the data coming back from the
+   * target, so the main loop applies the change once it has gone out. */
+  if (LineEncodingFlush || USARTTxIdle())
+  {
+    ApplyLineEncoding();
+  }
+  else
+  {
+    /* Allow for 12 bits per byte at the old baud rate, plus the two bytes already in the USART */
+    LineEncodingDrainStart   = MillisecondTicks;
+    LineEncodingDrainTimeout = ((((USBtoUSART_GetCount() + 2) * 12000UL) / AchievedBaudRateBPS) +
+                                LINE_ENCODING_DRAIN_MARGIN_MS);
+  }
+}
+
+/** Reconfigures the USART with the settings of the pending line encoding change. Data still queued for the target is
+ *  discarded, data from the target already in the ring buffer is kept. Called from the main loop and from the Line
+ *  Encoding Changed event, which runs with interrupts enabled, so the USART ISRs are kept out while the registers and
+ *  the ring buffer indexes are changed.
+ */
+static void ApplyLineEncoding(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    LineEncodingPending = false;
+
+    UCSR1B &= ~(1 << UDRIE1);
+    USBtoUSART_Out = USBtoUSART_In;
 
-  /* Must turn off USART before reconfiguring it, otherwise incorrect operation may occur */
-  UCSR1B = 0;
-  UCSR1A = 0;
-  UCSR1C = 0;
+    /* Keep the TX line held high (idle) while the USART is reconfigured */
+    PORTD |= (1 << 3);
 
-  /* Set the new baud rate before configuring the USART */
-  /* Special case 57600 baud for compatibility with the ATmega328 bootloader. */
-  UBRR1  = (CDCInterfaceInfo->State.LineEncoding.BaudRateBPS == 57600 || CDCInterfaceInfo->State.LineEncoding.BaudRateBPS == 300)
-      ? SERIAL_UBBRVAL(CDCInterfaceInfo->State.LineEncoding.BaudRateBPS)
-      : SERIAL_2X_UBBRVAL(CDCInterfaceInfo->State.LineEncoding.BaudRateBPS);
+    /* Must turn off USART before reconfiguring it, otherwise incorrect operation may occur */
+    UCSR1B = 0;
+    UCSR1A = 0;
+    UCSR1C = 0;
 
-  /* Reconfigure the USART in double speed mode for a wider baud rate range at the expense of accuracy */
-  UCSR1C = ConfigMask;
-  UCSR1A = (CDCInterfaceInfo->State.LineEncoding.BaudRateBPS == 57600 || CDCInterfaceInfo->State.LineEncoding.BaudRateBPS == 300) ? 0 : (1 << U2X1);
-  UCSR1B = ((1 << RXCIE1) | (1 << TXEN1) | (1 << RXEN1));
+    USARTTxStarted      = false;
+    AchievedBaudRateBPS = PendingBaudRateBPS;
+    HighSpeedMode       = (PendingBaudRateBPS >= HIGH_SPEED_BAUD_RATE);
 
-  /* Release the TX line after the USART has been reconfigured */
-  PORTD &= ~(1 << 3);
+    /* Leave the USART off until the host asks for a usable baud rate */
+    if (PendingBaudRateBPS)
+    {
+      /* Set the new baud rate before configuring the USART */
+      UBRR1  = PendingBaudRateRegister;
+
+      /* Reconfigure the USART, in double speed mode only where that gets closer to the requested baud rate */
+      UCSR1C = PendingConfigMask;
+      UCSR1A = (PendingDoubleSpeed ? (1 << U2X1) : 0);
+      UCSR1B = ((1 << RXCIE1) | (1 << TXEN1) | (1 << RXEN1));
+    }
+
+    /* Release the TX line after the USART has been reconfigured */
+    PORTD &= ~(1 << 3);
+  }
 }
 
 /** Event handler for the CDC Class driver Host-to-Device Line Encoding Changed event.
@@ -45,15 +45,56 @@
 #include <avr/power.h>
 #include <avr/eeprom.h>
 #include <util/delay.h>
+#include <util/atomic.h>
 #include "Descriptors.h"
 
 #include <LUFA/Drivers/Board/LEDs.h>
 #include <LUFA/Drivers/Peripheral/Serial.h>
-#include <LUFA/Drivers/Misc/RingBuffer.h>
 #include <LUFA/Drivers/USB/USB.h>
 #include <LUFA/Platform/Platform.h>
 
+/* Preprocessor Checks: */
+#if !defined(USARTTOUSB_BUFFER_SIZE) || !defined(USBTOUSART_BUFFER_SIZE)
+  #error USARTTOUSB_BUFFER_SIZE and USBTOUSART_BUFFER_SIZE must be set by the makefile, which reserves their RAM.
+#endif
+
+#if ((USARTTOUSB_BUFFER_SIZE > 256) || (USARTTOUSB_BUFFER_SIZE & (USARTTOUSB_BUFFER_SIZE - 1)) || \
+     (USBTOUSART_BUFFER_SIZE > 256) || (USBTOUSART_BUFFER_SIZE & (USBTOUSART_BUFFER_SIZE - 1)))
+  #error The ring buffer sizes must be powers of two of at most 256 bytes.
+#endif
+
 /* Macros: */
+/** Start addresses of the ring buffers, in the RAM the makefile reserves ahead of all other data. The larger
+ *  buffer goes first, at the 256 byte aligned start of RAM, which keeps both buffers aligned to their own size.
+ */
+#if (USARTTOUSB_BUFFER_SIZE >= USBTOUSART_BUFFER_SIZE)
+  #define USARTTOUSB_BUFFER_ADDR   RAMSTART
+  #define USBTOUSART_BUFFER_ADDR   (RAMSTART + USARTTOUSB_BUFFER_SIZE)
+#else
+  #define USBTOUSART_BUFFER_ADDR   RAMSTART
+  #define USARTTOUSB_BUFFER_ADDR   (RAMSTART + USBTOUSART_BUFFER_SIZE)
+#endif
+
+/** Lowest baud rate at which the bridge switches to high speed mode, where the latency timer is bypassed and every
+ *  free IN bank is filled as soon as there is data. At 2 Mbaud a byte arrives every 80 CPU cycles.
+ */
+#define HIGH_SPEED_BAUD_RATE     500000
+
+/** Time a line encoding change waits, on top of what the data queued for the target takes at the old baud rate, before
+ *  giving up and discarding it. Covers the target pausing the bridge with RTS for a moment.
+ */
+#define LINE_ENCODING_DRAIN_MARGIN_MS   20
+
+/** Time the device stays detached when switching between the CDC and WebUSB descriptor sets, long enough for the
+ *  host's hub to report the disconnect.
+ */
+#define USB_DETACH_TIME_MS       100
+
+/** Longest time a descriptor set switch waits for the host to collect the status stage of the request that asked for
+ *  it, before detaching anyway.
+ */
+#define USB_STATUS_STAGE_TIMEOUT_MS  50
+
 /** LED mask for the library LED driver, to indicate TX activity. */
 #define LEDMASK_TX               LEDS_LED1
 
@@ -66,16 +107,74 @@
 /** LED mask for the library LED driver, to indicate that the USB interface is busy. */
 #define LEDMASK_BUSY             (LEDS_LED1 | LEDS_LED2)
 
+/* Enums: */
+/** Bridge specific vendor requests. Like \ref WebUSB_RTYPE_Enable, these are issued with \ref WEBUSB_VENDOR_CODE as
+ *  bRequest and the request type in wIndex.
+ */
+enum Bridge_Request_t
+{
+  Bridge_RTYPE_SetLatencyTimer = 0x10, /**< Host to device. wValue is the time, in units of 100us, that a short packet of
+                                        *   UART data is held back to collect more bytes. 0 sends data immediately. */
+  Bridge_RTYPE_SetEventChar    = 0x11, /**< Host to device. wValue bits 0-7 hold a character that flushes the UART data
+                                        *   to the host as soon as it is received, bit 8 enables it. */
+  Bridge_RTYPE_SetFlowControl  = 0x12, /**< Host to device. wValue is the number of bytes waiting for the host at which
+                                        *   CTS to the target is deasserted, enabling RTS/CTS flow control. 0 disables it. */
+  Bridge_RTYPE_GetStatistics   = 0x13, /**< Device to host. Returns the \ref Bridge_Statistics_t counters. */
+  Bridge_RTYPE_ResetStatistics = 0x14, /**< Host to device. Clears the \ref Bridge_Statistics_t counters. */
+  Bridge_RTYPE_GetBaudRate     = 0x15, /**< Device to host. Returns the baud rate the USART actually runs at, as a 32-bit
+                                        *   little endian value, or 0 while no baud rate has been set. */
+  Bridge_RTYPE_SetFrameMode    = 0x16, /**< Host to device. wValue bit 0 set sends the UART data collected during each USB
+                                        *   frame as one packet at the start of the next frame, clear (default) sends
+                                        *   it as soon as an IN bank is free. */
+  Bridge_RTYPE_SetLineEncodingFlush = 0x17, /**< Host to device. wValue bit 0 set discards the data still queued for the
+                                             *   target when the line encoding changes, clear (default) sends it at the
+                                             *   old settings first. */
+};
+
+/* Type Defines: */
+/** Bridge statistics counters, returned to the host by \ref Bridge_RTYPE_GetStatistics in little endian format. The
+ *  counters wrap around on overflow and are cleared on power up and by \ref Bridge_RTYPE_ResetStatistics.
+ */
+typedef struct
+{
+  uint32_t USBtoUSARTBytes;      /**< Bytes received from the host for the serial port. */
+  uint32_t USARTtoUSBBytes;      /**< Bytes received from the serial port and sent to the host. */
+  uint32_t INPackets;            /**< Data packets (not counting ZLPs) sent to the host. */
+  uint32_t OUTNAKs;              /**< Main loop passes in which the host was NAKed because the OUT banks were full. */
+  uint16_t DroppedFull;          /**< Bytes from the serial port dropped because the ring buffer was full. */
+  uint16_t DroppedUnconfigured;  /**< Bytes from the serial port dropped because the device was not configured. */
+  uint16_t FramingErrors;        /**< Bytes received from the serial port with a framing error. */
+  uint16_t ParityErrors;         /**< Bytes received from the serial port with a parity error. */
+  uint16_t DataOverruns;         /**< Times the USART receive buffer overran before the receive ISR could empty it. */
+  uint8_t  USBtoUSARTHighWater;  /**< Highest fill level seen in the host to serial port ring buffer. */
+  uint8_t  USARTtoUSBHighWater;  /**< Highest fill level seen in the serial port to host ring buffer. */
+} ATTR_PACKED Bridge_Statistics_t;
+
 /* Function Prototypes: */
 void SetupHardware(void);
 
 void EVENT_USB_Device_Connect(void);
 void EVENT_USB_Device_Disconnect(void);
+void EVENT_USB_Device_Reset(void);
 void EVENT_USB_Device_ConfigurationChanged(void);
 void EVENT_USB_Device_ControlRequest(void);
+void EVENT_USB_Device_StartOfFrame(void);
 
 void EVENT_CDC_Device_LineEncodingChanged(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo);
 void EVENT_CDC_Device_ControLineStateChanged(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo);
 
+#if defined(INCLUDE_FROM_ARDUINO_USBSERIAL_C)
+static void SwitchDescriptorSet(void);
+static void ReceiveHostData(void);
+static void SendDeviceData(void);
+static void SendDeviceDataPerFrame(void);
+static void SendSerialState(void);
+static uint16_t GetTimerTick100us(void);
+static void SetFlowControl(const uint8_t HighWater);
+static bool USARTTxIdle(void);
+static void ApplyLineEncoding(void);
+static uint16_t SolveBaudRate(const uint32_t BaudRateBPS, bool* const DoubleSpeed, uint32_t* const AchievedBPS);
+#endif
+
 #endif
 
@@ -54,7 +54,7 @@
 //		#define HID_MAX_COLLECTIONS              {Insert Value Here}
 //		#define HID_MAX_REPORTITEMS              {Insert Value Here}
 //		#define HID_MAX_REPORT_IDS               {Insert Value Here}
-//		#define NO_CLASS_DRIVER_AUTOFLUSH
+		#define NO_CLASS_DRIVER_AUTOFLUSH        // IN packets and ZLPs are sent by SendDeviceData()
 
 		/* General USB Driver Related Tokens: */
 //		#define ORDERED_EP_CONFIG
@@ -63,7 +63,7 @@
 //		#define USB_HOST_ONLY
 //		#define USB_STREAM_TIMEOUT_MS            {Insert Value Here}
 //		#define NO_LIMITED_CONTROLLER_CONNECT
-//		#define NO_SOF_EVENTS
+//		#define NO_SOF_EVENTS                   // SOF events pace the IN packets in frame mode, see SendDeviceDataPerFrame()
 
 		/* USB Device Mode Driver Related Tokens: */
 //		#define USE_RAM_DESCRIPTORS
@@ -40,6 +40,10 @@
 
 uint8_t WebUSB_Enabled = 0;
 
+/** Set when Windows has requested the alternate (WebUSB) descriptor set through MS OS 2.0 alternate enumeration,
+ *  until the next bus reset. */
+uint8_t MS_OS_20_AltEnumeration = 0;
+
 /** Device descriptor structure. This descriptor, located in FLASH memory, describes the overall
  *  device characteristics, including the supported USB version, control endpoint size and the
  *  number of device configurations. The descriptor is read out by the USB host when the enumeration
@@ -193,7 +197,7 @@ const USB_Descriptor_Configuration_t PROGMEM ConfigurationDescriptor =
             .EndpointAddress        = CDC_NOTIFICATION_EPADDR,
             .Attributes             = (EP_TYPE_INTERRUPT | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
             .EndpointSize           = CDC_NOTIFICATION_EPSIZE,
-            .PollingIntervalMS      = 0xFF
+            .PollingIntervalMS      = 0x10
         },
 
     .CDC_DCI_Interface =
@@ -218,7 +222,7 @@ const USB_Descriptor_Configuration_t PROGMEM ConfigurationDescriptor =
 
             .EndpointAddress        = CDC_RX_EPADDR,
             .Attributes             = (EP_TYPE_BULK | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
-            .EndpointSize           = CDC_TXRX_EPSIZE,
+            .EndpointSize           = CDC_RX_EPSIZE,
             .PollingIntervalMS      = 0x05
         },
 
@@ -228,7 +232,7 @@ const USB_Descriptor_Configuration_t PROGMEM ConfigurationDescriptor =
 
             .EndpointAddress        = CDC_TX_EPADDR,
             .Attributes             = (EP_TYPE_BULK | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
-            .EndpointSize           = CDC_TXRX_EPSIZE,
+            .EndpointSize           = CDC_TX_EPSIZE,
             .PollingIntervalMS      = 0x05
         },
 
@@ -289,7 +293,7 @@ const USB_Descriptor_Configuration_WebUSB_t PROGMEM ConfigurationDescriptor_WebU
                 .EndpointAddress        = CDC_NOTIFICATION_EPADDR,
                 .Attributes             = (EP_TYPE_INTERRUPT | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
                 .EndpointSize           = CDC_NOTIFICATION_EPSIZE,
-                .PollingIntervalMS      = 0xFF
+                .PollingIntervalMS      = 0x10
             },
 
         .CDC_DataOutEndpoint =
@@ -298,7 +302,7 @@ const USB_Descriptor_Configuration_WebUSB_t PROGMEM ConfigurationDescriptor_WebU
 
                 .EndpointAddress        = CDC_RX_EPADDR,
                 .Attributes             = (EP_TYPE_BULK | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
-                .EndpointSize           = CDC_TXRX_EPSIZE,
+                .EndpointSize           = CDC_RX_EPSIZE,
                 .PollingIntervalMS      = 0x05
             },
 
@@ -308,7 +312,7 @@ const USB_Descriptor_Configuration_WebUSB_t PROGMEM ConfigurationDescriptor_WebU
 
                 .EndpointAddress        = CDC_TX_EPADDR,
                 .Attributes             = (EP_TYPE_BULK | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
-                .EndpointSize           = CDC_TXRX_EPSIZE,
+                .EndpointSize           = CDC_TX_EPSIZE,
                 .PollingIntervalMS      = 0x05
             },
 };
@@ -374,11 +378,12 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 
     const void* Address = NULL;
     uint16_t    Size    = NO_DESCRIPTOR;
+    const bool  WebUSB  = (WebUSB_Enabled || MS_OS_20_AltEnumeration);
 
     switch (DescriptorType)
     {
         case DTYPE_Device:
-            if (WebUSB_Enabled) {
+            if (WebUSB) {
                 Address = &DeviceDescriptor_WebUSB;
                 LEDs_ToggleLEDs(LEDS_LED1);
             } else {
@@ -388,7 +393,7 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
             Size    = sizeof(USB_Descriptor_Device_t);
             break;
         case DTYPE_BOS:
-            if (WebUSB_Enabled) {
+            if (WebUSB) {
                 Address = &BOSDescriptor_WebUSB;
                 Size = pgm_read_byte(&BOSDescriptor_WebUSB.TotalLength);
                 LEDs_ToggleLEDs(LEDS_LED1);
@@ -398,7 +403,7 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
             }
             break;
         case DTYPE_Configuration:
-            if (WebUSB_Enabled) {
+            if (WebUSB) {
                 Address = &ConfigurationDescriptor_WebUSB;
                 Size    = sizeof(USB_Descriptor_Configuration_WebUSB_t);
                 LEDs_ToggleLEDs(LEDS_LED1);
@@ -415,7 +420,7 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
                     Size    = pgm_read_byte(&LanguageString.Header.Size);
                     break;
                 case STRING_ID_Manufacturer:
-                    if (WebUSB_Enabled) {
+                    if (WebUSB) {
                         Address = &ManufacturerString_WebUSB;
                         Size    = pgm_read_byte(&ManufacturerString_WebUSB.Header.Size);
                     } else {
@@ -424,7 +429,7 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
                     }
                     break;
                 case STRING_ID_Product:
-                    if (WebUSB_Enabled) {
+                    if (WebUSB) {
                         Address = &ProductString_WebUSB;
                         Size    = pgm_read_byte(&ProductString_WebUSB.Header.Size);
                     } else {
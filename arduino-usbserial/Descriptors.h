@@ -69,11 +69,37 @@
 /** Size in bytes of the CDC device-to-host notification IN endpoint. */
 #define CDC_NOTIFICATION_EPSIZE        8
 
-/** Size in bytes of the CDC data IN and OUT endpoints. */
-#define CDC_TXRX_EPSIZE                64
+/** Size in bytes of the CDC data IN endpoint. */
+#ifndef CDC_TX_EPSIZE
+#define CDC_TX_EPSIZE                  64
+#endif
+
+/** Number of banks of the CDC data IN endpoint, 2 to fill one bank while the other is in flight. */
+#ifndef CDC_TX_BANK_SIZE
+#define CDC_TX_BANK_SIZE               2
+#endif
+
+/** Size in bytes of the CDC data OUT endpoint. */
+#ifndef CDC_RX_EPSIZE
+#define CDC_RX_EPSIZE                  16
+#endif
+
+/** Number of banks of the CDC data OUT endpoint, 2 so the host can queue a packet while the other is read. */
+#ifndef CDC_RX_BANK_SIZE
+#define CDC_RX_BANK_SIZE               2
+#endif
+
+/** Total endpoint DPRAM of the 8/16/32u2, shared by the control endpoint and all of the CDC endpoints. */
+#define USB_DPRAM_SIZE                 176
+
+#if ((FIXED_CONTROL_ENDPOINT_SIZE + CDC_NOTIFICATION_EPSIZE + (CDC_TX_EPSIZE * CDC_TX_BANK_SIZE) + \
+      (CDC_RX_EPSIZE * CDC_RX_BANK_SIZE)) > USB_DPRAM_SIZE)
+  #error The CDC endpoint sizes and bank counts exceed the USB DPRAM of the target.
+#endif
 
-/* Shared state variable */
+/* Shared state variables */
 extern uint8_t WebUSB_Enabled;
+extern uint8_t MS_OS_20_AltEnumeration;
 
 /* Type Defines: */
 /** Type define for the device configuration descriptor structure. This must be defined in the
@@ -0,0 +1,112 @@
+/*
+  Copyright 2019  Modkit Inc. (open [at] modkit [dot] com)
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Checks the baud rate table in notes.md against the firmware. Every row's requested rate is set with Set Line
+ *  Coding, and the USART mode, UBRR value and the achieved rate returned by the get baud rate request must match the
+ *  row, as must the error worked out from them.
+ *
+ *  Usage: bridge-baudrates path/to/notes.md
+ */
+
+#include "BridgeModel.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/** Bridge_RTYPE_GetBaudRate, see Arduino-usbserial.h */
+#define GET_BAUD_RATE_REQUEST    0x15
+
+int main(int argc, char** argv)
+{
+  if (argc != 2)
+  {
+    fprintf(stderr, "Usage: %s notes.md\n", argv[0]);
+    return 2;
+  }
+
+  FILE* Notes = fopen(argv[1], "r");
+
+  if (!(Notes))
+  {
+    perror(argv[1]);
+    return 2;
+  }
+
+  char     Line[256];
+  bool     InTable = false;
+  unsigned Rows    = 0;
+  unsigned Failed  = 0;
+
+  while (fgets(Line, sizeof(Line), Notes))
+  {
+    if (!(InTable))
+    {
+      InTable = !(strncmp(Line, "| Requested | Mode", 18));
+      continue;
+    }
+
+    if (Line[0] != '|')
+      break;
+
+    uint32_t Requested, Achieved;
+    unsigned UBRR;
+    char     Mode[8], Error[16];
+
+    /* Skips the separator row, which has no numbers */
+    if (sscanf(Line, "| %u | %7s | %u | %u | %15s |", &Requested, Mode, &UBRR, &Achieved, Error) != 5)
+      continue;
+
+    Model_SetLineCoding(Requested);
+
+    uint32_t ReportedBPS = 0;
+    bool     DoubleSpeed = Model_GetDoubleSpeed();
+    char     ReportedError[16];
+
+    Model_VendorRequestIn(GET_BAUD_RATE_REQUEST, &ReportedBPS, sizeof(ReportedBPS));
+    snprintf(ReportedError, sizeof(ReportedError), "%+.2f%%",
+             (100.0 * ((double)ReportedBPS - Requested) / Requested));
+
+    if ((DoubleSpeed != !(strcmp(Mode, "U2X"))) || (Model_GetUBRR() != UBRR) || (ReportedBPS != Achieved) ||
+        strcmp(ReportedError, Error))
+    {
+      printf("%8u: notes.md has %s UBRR %u, %u baud (%s), the firmware picks %s UBRR %u, %u baud (%s)\n", Requested,
+             Mode, UBRR, Achieved, Error, (DoubleSpeed ? "U2X" : "normal"), Model_GetUBRR(), ReportedBPS,
+             ReportedError);
+      Failed++;
+    }
+
+    Rows++;
+  }
+
+  fclose(Notes);
+
+  if (!(Rows))
+  {
+    printf("No baud rate table found in %s\n", argv[1]);
+    return 1;
+  }
+
+  printf("%u of %u baud rates in %s match the firmware\n", (Rows - Failed), Rows, argv[1]);
+  return (Failed ? 1 : 0);
+}
@@ -0,0 +1,159 @@
+/*
+  Copyright 2019  Modkit Inc. (open [at] modkit [dot] com)
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Streams a counting pattern through the modelled bridge at a range of baud rates, and reports the throughput, the
+ *  IN packet sizes, the latency in each direction and any loss. With --check the exit status is non-zero if any byte
+ *  was lost.
+ *
+ *  Usage: bridge-benchmark [--check] [--host-to-target | --target-to-host] [--bytes N] [--latency N]
+ *                          [--frame-mode] [--pass-cycles N] [--byte-cycles N] [--rx-isr-cycles N]
+ *                          [--udre-isr-cycles N] [--in-per-frame N] [--switch-baud N] [baud ...]
+ *
+ *  By default the target echoes the stream back to the host. --host-to-target and --target-to-host stream in one
+ *  direction only, so that neither direction's ISR paces the other.
+ *
+ *  --switch-baud sends Set Line Coding with a new rate once the host has sent half of its stream, to check that nothing
+ *  queued for the target is lost or sent at the wrong rate. It has no effect with --target-to-host.
+ */
+
+#include "BridgeModel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint32_t DefaultBaudRates[] = {9600, 57600, 115200, 250000, 500000, 1000000, 2000000};
+
+/** Returns the average latency of a direction in microseconds, or 0 if no bytes went that way. */
+static double AverageLatency(const Model_Latency_t* const Latency)
+{
+  if (!(Latency->Bytes))
+    return 0;
+
+  return ((double)Latency->TotalCycles / Latency->Bytes / (MODEL_FRAME_CYCLES / 1000));
+}
+
+int main(int argc, char** argv)
+{
+  Model_Config_t Config;
+  bool           Check     = false;
+  uint32_t       BaudRates[32];
+  uint8_t        BaudCount = 0;
+
+  Model_DefaultConfig(&Config);
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char* Option = argv[i];
+    bool        Value  = ((i + 1) < argc);
+
+    if (!(strcmp(Option, "--check")))
+      Check = true;
+    else if (!(strcmp(Option, "--host-to-target")))
+      Config.Direction = MODEL_HOST_TO_TARGET;
+    else if (!(strcmp(Option, "--target-to-host")))
+      Config.Direction = MODEL_TARGET_TO_HOST;
+    else if (!(strcmp(Option, "--frame-mode")))
+      Config.FrameMode = true;
+    else if (!(strcmp(Option, "--bytes")) && Value)
+      Config.Bytes = strtoul(argv[++i], NULL, 0);
+    else if (!(strcmp(Option, "--latency")) && Value)
+      Config.LatencyTimer = strtoul(argv[++i], NULL, 0);
+    else if (!(strcmp(Option, "--pass-cycles")) && Value)
+      Config.PassCycles = strtoul(argv[++i], NULL, 0);
+    else if (!(strcmp(Option, "--byte-cycles")) && Value)
+      Config.EndpointByteCycles = strtoul(argv[++i], NULL, 0);
+    else if (!(strcmp(Option, "--rx-isr-cycles")) && Value)
+      Config.RxISRCycles = strtoul(argv[++i], NULL, 0);
+    else if (!(strcmp(Option, "--udre-isr-cycles")) && Value)
+      Config.UdreISRCycles = strtoul(argv[++i], NULL, 0);
+    else if (!(strcmp(Option, "--switch-baud")) && Value)
+      Config.SwitchBaudRateBPS = strtoul(argv[++i], NULL, 0);
+    else if (!(strcmp(Option, "--in-per-frame")) && Value)
+      Config.INPacketsPerFrame = strtoul(argv[++i], NULL, 0);
+    else if ((Option[0] != '-') && (BaudCount < (sizeof(BaudRates) / sizeof(BaudRates[0]))))
+      BaudRates[BaudCount++] = strtoul(Option, NULL, 0);
+    else
+    {
+      fprintf(stderr, "Unknown option %s\n", Option);
+      return 2;
+    }
+  }
+
+  if (!(BaudCount))
+  {
+    BaudCount = (sizeof(DefaultBaudRates) / sizeof(DefaultBaudRates[0]));
+    memcpy(BaudRates, DefaultBaudRates, sizeof(DefaultBaudRates));
+  }
+
+  printf("%8s %9s %9s %6s %7s %6s %6s %6s %5s %5s %6s %5s %7s %7s %7s %7s\n", "baud", "out B/s", "in B/s",
+         "line%", "in pkts", "B/pkt", "lost", "wrong", "full", "ovr", "naks", "high", "in us", "max", "out us", "max");
+
+  bool Failed = false;
+
+  for (uint8_t i = 0; i < BaudCount; i++)
+  {
+    Model_Result_t Result;
+
+    Config.BaudRateBPS = BaudRates[i];
+
+    if (!(Model_Run(&Config, &Result)))
+    {
+      printf("%8u model failed\n", Config.BaudRateBPS);
+      Failed = true;
+      continue;
+    }
+
+    /* Out is what reached the target, in is what reached the host, and the line is as busy as the busier of them */
+    double   LineRate = (Config.BaudRateBPS / 10.0);
+    double   OutRate  = (Result.TargetIn / Result.Seconds);
+    double   InRate   = (Result.BytesIn / Result.Seconds);
+    uint32_t Lost;
+
+    switch (Config.Direction)
+    {
+      case MODEL_HOST_TO_TARGET:
+        Lost = (Result.BytesOut - Result.TargetIn);
+        break;
+      case MODEL_TARGET_TO_HOST:
+        Lost = (Result.TargetOut - Result.BytesIn);
+        break;
+      default:
+        Lost = (Result.BytesOut - Result.BytesIn);
+        break;
+    }
+
+    printf("%8u %9.0f %9.0f %5.1f%% %7u %6.1f %6u %6u %5u %5u %6u %5u %7.0f %7.0f %7.0f %7.0f%s\n",
+           Config.BaudRateBPS, OutRate, InRate, (100.0 * ((OutRate > InRate) ? OutRate : InRate) / LineRate),
+           Result.INPackets, (Result.INPackets ? ((double)Result.BytesIn / Result.INPackets) : 0.0), Lost,
+           Result.Mismatched, Result.DroppedFull, Result.DataOverruns, Result.OUTNAKs, Result.HighWater, AverageLatency(&Result.IN),
+           (Result.IN.MaxCycles / (MODEL_FRAME_CYCLES / 1000.0)), AverageLatency(&Result.OUT),
+           (Result.OUT.MaxCycles / (MODEL_FRAME_CYCLES / 1000.0)), (Result.Saturated ? " ISRs saturate the CPU" : ""));
+
+    if (Lost || Result.Mismatched || Result.DroppedFull || Result.Saturated)
+      Failed = true;
+  }
+
+  return ((Check && Failed) ? 1 : 0);
+}
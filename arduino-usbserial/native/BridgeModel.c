@@ -0,0 +1,780 @@
+/*
+  Copyright 2019  Modkit Inc. (open [at] modkit [dot] com)
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Runs the bridge firmware on the build machine. Arduino-usbserial.c is compiled as part of this file, unmodified
+ *  apart from its entry point being renamed, so that the model can reach its static state.
+ *
+ *  Time is counted in CPU cycles. Every main loop pass is charged a fixed cost plus a cost per byte moved through an
+ *  endpoint, and ends in USB_USBTask(), where the model lets the USART, the target and the USB host run for that long.
+ *  The USART ISRs are called when their interrupts would fire between passes, and their cost is added to the pass.
+ *
+ *  The host sends a counting pattern in full OUT packets and collects up to a set number of IN packets per frame.
+ *  The target runs at the bridge's baud rate and either echoes everything it receives, only checks it, or sends a
+ *  counting pattern of its own back-to-back. Whichever end receives the pattern checks that it arrives intact, and
+ *  every byte's latency through the bridge is measured in both directions.
+ *
+ *  Not modelled: ISRs interrupting each other or the middle of a pass, baud rate mismatch between bridge and target,
+ *  and USB bus errors.
+ */
+
+#define main Bridge_Main
+#include "../Arduino-usbserial.c"
+#undef main
+
+#include "BridgeModel.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Registers and memory of the target, see Native.h */
+volatile uint8_t  MCUSR, TIFR0, TCCR0A, TCCR0B, TCNT0, OCR0A;
+volatile uint8_t  PORTB, DDRB, PINB, PORTD, DDRD, GPIOR1, GPIOR2;
+volatile uint8_t  UCSR1A, UCSR1B, UCSR1C, UDR1, UEINTX;
+volatile uint16_t UBRR1;
+
+uint8_t Native_RAM[USARTTOUSB_BUFFER_SIZE + USBTOUSART_BUFFER_SIZE];
+uint8_t Native_EEPROM[512];
+
+volatile uint8_t     USB_DeviceState;
+USB_Request_Header_t USB_ControlRequest;
+
+/* Defined by Descriptors.c in the firmware build */
+uint8_t WebUSB_Enabled;
+uint8_t MS_OS_20_AltEnumeration;
+
+/** Size of the echoing target's queue, which never overflows in practice. */
+#define TARGET_QUEUE_SIZE        65536
+
+/** Bytes in flight through the bridge whose start times are kept for the latency, a power of two well above the
+ *  ring buffers and endpoint banks combined. */
+#define LATENCY_WINDOW           4096
+
+/** Model of one endpoint's banks. The CPU and the host each work through the banks in order. */
+typedef struct
+{
+  uint8_t Data[2][CDC_TX_EPSIZE];
+  uint8_t Count[2];
+  uint8_t Size;
+  uint8_t Banks;
+  bool    IsIN;
+  uint8_t CPUBank;    /**< Bank the CPU reads or writes. */
+  uint8_t HostBank;   /**< Bank the host fills or collects next. */
+  uint8_t Queued;     /**< IN: banks waiting for the host, OUT: banks waiting for the CPU. */
+  uint8_t Position;   /**< CPU read or write position in \ref CPUBank. */
+} Model_Endpoint_t;
+
+static struct
+{
+  Model_Config_t   Config;
+  Model_Result_t   Result;
+  jmp_buf          Exit;
+
+  uint64_t         Now;
+  uint64_t         NextFrame;
+  uint64_t         StartTime;
+  uint64_t         Deadline;
+  uint32_t         EndpointBytes;
+  uint16_t         LastMillisecondTicks;
+  bool             TimerFlag;
+
+  Model_Endpoint_t Endpoints[4];
+  uint8_t          Selected;
+  uint8_t          INBudget;
+  uint8_t          OUTBudget;
+  bool             OUTNAKed;
+  bool             SOFEvents;
+  bool             Attached;
+  uint64_t         AttachTime;
+  bool             HostConfigured;
+  bool             HostSwitched;
+  bool             ControlStatusPending;
+  uint8_t          ControlData[64];
+  uint16_t         ControlLength;
+  uint32_t         PendingBaudRateBPS;
+
+  bool             TxShifting;
+  uint8_t          TxShiftByte;
+  double           TxShiftEnd;
+  bool             TxBufferFull;
+  uint8_t          TxBuffer;
+  bool             TxComplete;
+
+  uint8_t          TargetQueue[TARGET_QUEUE_SIZE];
+  uint32_t         TargetQueueIn;
+  uint32_t         TargetQueueOut;
+  bool             TargetStreaming;
+  double           RxNext;
+  uint32_t         RxBytes;
+
+  uint64_t         OUTStart[LATENCY_WINDOW];
+  uint64_t         INStart[LATENCY_WINDOW];
+} Model;
+
+static void Model_Advance(const uint64_t Cycles);
+
+/** Returns the CPU cycles one frame takes on the wire with the USART's current settings. */
+static double Model_ByteCycles(void)
+{
+  uint8_t Bits = (1 + 5 + ((UCSR1C >> UCSZ10) & 3) + ((UCSR1C & (1 << UPM11)) ? 1 : 0) +
+                  ((UCSR1C & (1 << USBS1)) ? 2 : 1));
+
+  return ((double)Bits * ((UCSR1A & (1 << U2X1)) ? 8 : 16) * (UBRR1 + 1));
+}
+
+/** Makes the transmit complete flag in UCSR1A follow the model, after firmware writes to the register. */
+static void Model_SyncTXC(void)
+{
+  /* Writing a one to TXC1 clears the flag */
+  if (UCSR1A & (1 << TXC1))
+    Model.TxComplete = false;
+
+  UCSR1A = ((UCSR1A & ~(1 << TXC1)) | (Model.TxComplete ? (1 << TXC1) : 0));
+}
+
+/** Hands a control request to the firmware, as the USB controller's interrupt would. */
+static void Model_ControlRequest(const uint8_t bmRequestType, const uint8_t bRequest, const uint16_t wValue,
+                                 const uint16_t wIndex, const uint16_t wLength)
+{
+  USB_ControlRequest = (USB_Request_Header_t){bmRequestType, bRequest, wValue, wIndex, wLength};
+  Model.ControlLength = 0;
+
+  UCSR1A &= ~(1 << TXC1);
+  EVENT_USB_Device_ControlRequest();
+  Model_SyncTXC();
+}
+
+void Model_SetLineCoding(const uint32_t BaudRateBPS)
+{
+  Model.PendingBaudRateBPS = BaudRateBPS;
+  Model_ControlRequest((REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE), 0x20, 0, 0, 7);
+}
+
+uint8_t Model_VendorRequestIn(const uint8_t Request, void* const Data, const uint16_t Length)
+{
+  Model_ControlRequest((REQDIR_DEVICETOHOST | REQTYPE_VENDOR | REQREC_DEVICE), WEBUSB_VENDOR_CODE, 0, Request, Length);
+
+  uint8_t Received = MIN(Model.ControlLength, Length);
+  memcpy(Data, Model.ControlData, Received);
+  return Received;
+}
+
+static void Model_VendorRequestOut(const uint8_t Request, const uint16_t Value)
+{
+  Model_ControlRequest((REQDIR_HOSTTODEVICE | REQTYPE_VENDOR | REQREC_DEVICE), WEBUSB_VENDOR_CODE, Value, Request, 0);
+}
+
+uint16_t Model_GetUBRR(void)
+{
+  return UBRR1;
+}
+
+bool Model_GetDoubleSpeed(void)
+{
+  return (UCSR1A & (1 << U2X1));
+}
+
+/** Adds the latency of a byte that started out at the given time and has just arrived. */
+static void Model_AddLatency(Model_Latency_t* const Latency, const uint64_t Start)
+{
+  uint32_t Cycles = (Model.Now - Start);
+
+  Latency->TotalCycles += Cycles;
+  Latency->Bytes++;
+
+  if (Cycles > Latency->MaxCycles)
+    Latency->MaxCycles = Cycles;
+}
+
+/** Ends the run and returns to \ref Model_Run(). */
+static void Model_Finish(void)
+{
+  Bridge_Statistics_t BridgeStatistics = {0};
+
+  Model.Result.Seconds = ((double)(Model.Now - Model.StartTime) / F_CPU);
+
+  Model_VendorRequestIn(Bridge_RTYPE_GetStatistics, &BridgeStatistics, sizeof(BridgeStatistics));
+  Model.Result.DroppedFull  = BridgeStatistics.DroppedFull;
+  Model.Result.DataOverruns = BridgeStatistics.DataOverruns;
+
+  longjmp(Model.Exit, 1);
+}
+
+/** Returns true if the target has a byte to send to the bridge. */
+static bool Model_TargetHasData(void)
+{
+  if (Model.Config.Direction == MODEL_TARGET_TO_HOST)
+    return (Model.TargetStreaming && (Model.Result.TargetOut < Model.Config.Bytes));
+
+  return (Model.TargetQueueIn != Model.TargetQueueOut);
+}
+
+/** Passes a byte the bridge has sent to the target, which echoes it or checks it. */
+static void Model_TargetReceive(const uint8_t Data)
+{
+  Model_AddLatency(&Model.Result.OUT, Model.OUTStart[Model.Result.TargetIn % LATENCY_WINDOW]);
+
+  if (Model.Config.Direction == MODEL_HOST_TO_TARGET)
+  {
+    if (Data != (uint8_t)Model.Result.TargetIn)
+      Model.Result.Mismatched++;
+  }
+  else
+  {
+    if (!(Model_TargetHasData()))
+      Model.RxNext = (Model.Now + Model_ByteCycles());
+
+    Model.TargetQueue[Model.TargetQueueIn++ % TARGET_QUEUE_SIZE] = Data;
+  }
+
+  Model.Result.TargetIn++;
+}
+
+/** Returns the next byte the target sends to the bridge. */
+static uint8_t Model_TargetSend(void)
+{
+  if (Model.Config.Direction == MODEL_TARGET_TO_HOST)
+    return (uint8_t)Model.Result.TargetOut++;
+
+  Model.Result.TargetOut++;
+  return Model.TargetQueue[Model.TargetQueueOut++ % TARGET_QUEUE_SIZE];
+}
+
+/** Loads a byte written to UDR1 into the transmitter. */
+static void Model_LoadTx(const uint8_t Data)
+{
+  if (!(Model.TxShifting))
+  {
+    Model.TxShifting  = true;
+    Model.TxShiftByte = Data;
+    Model.TxShiftEnd  = (Model.Now + Model_ByteCycles());
+    Model.TxComplete  = false;
+  }
+  else
+  {
+    Model.TxBufferFull = true;
+    Model.TxBuffer     = Data;
+  }
+
+  Model_SyncTXC();
+}
+
+/** Calls the data register empty ISR for as long as it is enabled and the transmit buffer has room. */
+static void Model_ServiceUDRE(uint64_t* const End)
+{
+  while ((UCSR1B & (1 << UDRIE1)) && (UCSR1B & (1 << TXEN1)) && !(Model.TxBufferFull))
+  {
+    uint8_t Out = USBtoUSART_Out;
+
+    UCSR1A &= ~(1 << TXC1);
+    USART1_UDRE_vect();
+    Model_SyncTXC();
+    *End += Model.Config.UdreISRCycles;
+
+    if (USBtoUSART_Out != Out)
+      Model_LoadTx(UDR1);
+    else
+      break;
+  }
+}
+
+/** Returns the packet the host collected to the benchmark, which checks it against the sent pattern. */
+static void Model_HostReceive(const uint8_t* const Data, const uint8_t Count)
+{
+  if (!(Count))
+    Model.Result.ZLPs++;
+  else
+    Model.Result.INPackets++;
+
+  for (uint8_t i = 0; i < Count; i++)
+  {
+    if (Data[i] != (uint8_t)Model.Result.BytesIn)
+      Model.Result.Mismatched++;
+
+    Model_AddLatency(&Model.Result.IN, Model.INStart[Model.Result.BytesIn % LATENCY_WINDOW]);
+    Model.Result.BytesIn++;
+  }
+}
+
+/** Lets the host enumerate the device, collect IN packets and send OUT packets within the current frame's budget. */
+static void Model_ServiceHost(void)
+{
+  if (!(Model.Attached))
+    return;
+
+  if (USB_DeviceState != DEVICE_STATE_Configured)
+  {
+    /* Enumerate a frame after attaching */
+    if (Model.Now < (Model.AttachTime + MODEL_FRAME_CYCLES))
+      return;
+
+    EVENT_USB_Device_Reset();
+    USB_DeviceState = DEVICE_STATE_Configured;
+    EVENT_USB_Device_ConfigurationChanged();
+  }
+
+  /* The status stage of a control request completes at once */
+  Model.ControlStatusPending = false;
+
+  if (!(Model.HostConfigured))
+  {
+    Model.HostConfigured = true;
+
+    Model_SetLineCoding(Model.Config.BaudRateBPS);
+    Model_VendorRequestOut(Bridge_RTYPE_SetLatencyTimer, Model.Config.LatencyTimer);
+    Model_VendorRequestOut(Bridge_RTYPE_SetFrameMode, Model.Config.FrameMode);
+    Model_VendorRequestOut(Bridge_RTYPE_ResetStatistics, 0);
+
+    Model.ControlStatusPending = false;
+    Model.StartTime = Model.Now;
+
+    /* The target starts streaming once the bridge is set up, as a sketch would once the host opens the port */
+    if (Model.Config.Direction == MODEL_TARGET_TO_HOST)
+    {
+      Model.TargetStreaming = true;
+      Model.RxNext          = (Model.Now + Model_ByteCycles());
+    }
+  }
+
+  Model_Endpoint_t* Notification = &Model.Endpoints[CDC_NOTIFICATION_EPADDR & 0x0F];
+  Model_Endpoint_t* IN           = &Model.Endpoints[CDC_TX_EPADDR & 0x0F];
+  Model_Endpoint_t* OUT          = &Model.Endpoints[CDC_RX_EPADDR & 0x0F];
+
+  while (Notification->Queued)
+  {
+    Notification->HostBank = ((Notification->HostBank + 1) % Notification->Banks);
+    Notification->Queued--;
+  }
+
+  while (IN->Queued && Model.INBudget)
+  {
+    Model_HostReceive(IN->Data[IN->HostBank], IN->Count[IN->HostBank]);
+    IN->HostBank = ((IN->HostBank + 1) % IN->Banks);
+    IN->Queued--;
+    Model.INBudget--;
+  }
+
+  if (Model.Config.Direction == MODEL_TARGET_TO_HOST)
+    return;
+
+  while ((Model.Result.BytesOut < Model.Config.Bytes) && Model.OUTBudget)
+  {
+    if (OUT->Queued == OUT->Banks)
+    {
+      if (!(Model.OUTNAKed))
+        Model.Result.OUTNAKs++;
+
+      Model.OUTNAKed = true;
+      UEINTX        |= (1 << NAKOUTI);
+      break;
+    }
+
+    uint8_t Count = MIN(CDC_RX_EPSIZE, (Model.Config.Bytes - Model.Result.BytesOut));
+
+    for (uint8_t i = 0; i < Count; i++)
+    {
+      OUT->Data[OUT->HostBank][i] = (uint8_t)(Model.Result.BytesOut + i);
+      Model.OUTStart[(Model.Result.BytesOut + i) % LATENCY_WINDOW] = Model.Now;
+    }
+
+    OUT->Count[OUT->HostBank] = Count;
+    OUT->HostBank = ((OUT->HostBank + 1) % OUT->Banks);
+    OUT->Queued++;
+    Model.Result.BytesOut += Count;
+    Model.OUTBudget--;
+  }
+
+  /* Change the baud rate in the middle of the stream, the target follows the bridge */
+  if (Model.Config.SwitchBaudRateBPS && !(Model.HostSwitched) && (Model.Result.BytesOut >= (Model.Config.Bytes / 2)))
+  {
+    Model.HostSwitched = true;
+    Model_SetLineCoding(Model.Config.SwitchBaudRateBPS);
+  }
+}
+
+/** Lets everything but the main loop run for the given number of CPU cycles, which the ISRs extend. */
+static void Model_Advance(const uint64_t Cycles)
+{
+  uint64_t End   = (Model.Now + Cycles);
+  uint64_t Limit = (Model.Now + (MODEL_FRAME_CYCLES * 100));
+
+  while (Model.Now < End)
+  {
+    uint64_t Next = End;
+
+    if (Model.NextFrame < Next)
+      Next = Model.NextFrame;
+
+    if (Model.TxShifting && ((uint64_t)Model.TxShiftEnd < Next))
+      Next = (uint64_t)Model.TxShiftEnd;
+
+    if (Model_TargetHasData() && ((uint64_t)Model.RxNext < Next))
+      Next = (uint64_t)Model.RxNext;
+
+    if (Next > Model.Now)
+      Model.Now = Next;
+
+    if (Model.Now >= Model.NextFrame)
+    {
+      Model.NextFrame += MODEL_FRAME_CYCLES;
+      Model.INBudget   = Model.Config.INPacketsPerFrame;
+      Model.OUTBudget  = Model.Config.OUTPacketsPerFrame;
+      Model.OUTNAKed   = false;
+
+      /* Timer 0 is set up for a compare match every millisecond, the same as a frame */
+      if (TCCR0B)
+        Model.TimerFlag = true;
+
+      if (Model.SOFEvents && (USB_DeviceState == DEVICE_STATE_Configured))
+        EVENT_USB_Device_StartOfFrame();
+
+      Model_ServiceHost();
+    }
+
+    if (Model.TxShifting && (Model.Now >= (uint64_t)Model.TxShiftEnd))
+    {
+      Model_TargetReceive(Model.TxShiftByte);
+
+      if (Model.TxBufferFull)
+      {
+        Model.TxShiftByte   = Model.TxBuffer;
+        Model.TxBufferFull  = false;
+        Model.TxShiftEnd   += Model_ByteCycles();
+      }
+      else
+      {
+        Model.TxShifting = false;
+        Model.TxComplete = true;
+        Model_SyncTXC();
+      }
+    }
+
+    if (Model_TargetHasData() && (Model.Now >= (uint64_t)Model.RxNext))
+    {
+      uint8_t Data = Model_TargetSend();
+
+      if (Model_TargetHasData())
+        Model.RxNext += Model_ByteCycles();
+
+      if ((UCSR1B & (1 << RXEN1)) && (UCSR1B & (1 << RXCIE1)))
+      {
+        Model.INStart[Model.RxBytes++ % LATENCY_WINDOW] = Model.Now;
+
+        UDR1    = Data;
+        UCSR1A |= (1 << RXC1);
+        USART1_RX_vect();
+        UCSR1A &= ~((1 << RXC1) | (1 << FE1) | (1 << UPE1) | (1 << DOR1));
+        End    += Model.Config.RxISRCycles;
+
+        uint8_t Count = USARTtoUSB_GetCount();
+
+        if (Count > Model.Result.HighWater)
+          Model.Result.HighWater = Count;
+      }
+    }
+
+    Model_ServiceUDRE(&End);
+
+    if (End > Limit)
+    {
+      /* The ISRs took all of the CPU time, the main loop would never run again */
+      Model.Result.Saturated = true;
+      Model_Finish();
+    }
+  }
+}
+
+/** Returns true once the receiving end has all of the bytes. */
+static bool Model_Done(void)
+{
+  if (Model.Config.Direction == MODEL_HOST_TO_TARGET)
+    return (Model.Result.TargetIn >= Model.Config.Bytes);
+
+  return (Model.Result.BytesIn >= Model.Config.Bytes);
+}
+
+void Model_Delay(const uint32_t Cycles)
+{
+  Model_Advance(Cycles);
+}
+
+/* LUFA USB core */
+void USB_Init(void)
+{
+  Model.Attached   = true;
+  Model.AttachTime = Model.Now;
+  USB_DeviceState  = DEVICE_STATE_Powered;
+}
+
+void USB_Disable(void)
+{
+  Model.Attached  = false;
+  USB_DeviceState = DEVICE_STATE_Unattached;
+}
+
+/** The last call of every main loop pass, where the model charges the pass and lets the rest of the system run. */
+void USB_USBTask(void)
+{
+  Model.Result.Passes++;
+
+  /* The firmware counts a millisecond as it clears the compare flag */
+  if (MillisecondTicks != Model.LastMillisecondTicks)
+  {
+    Model.LastMillisecondTicks = MillisecondTicks;
+    Model.TimerFlag            = false;
+  }
+
+  Model_Advance(Model.Config.PassCycles + (Model.EndpointBytes * Model.Config.EndpointByteCycles));
+  Model.EndpointBytes = 0;
+
+  Model_ServiceHost();
+
+  if (Model_Done() || (Model.Now > Model.Deadline))
+    Model_Finish();
+
+  TIFR0 = (Model.TimerFlag ? (1 << OCF0A) : 0);
+  TCNT0 = ((Model.Now / 64) % 250);
+}
+
+void USB_Device_EnableSOFEvents(void)
+{
+  Model.SOFEvents = true;
+}
+
+void USB_Device_DisableSOFEvents(void)
+{
+  Model.SOFEvents = false;
+}
+
+/* LUFA endpoints */
+void Endpoint_SelectEndpoint(const uint8_t Address)
+{
+  Model.Selected = (Address & 0x0F);
+}
+
+bool Endpoint_IsINReady(void)
+{
+  if (Model.Selected == ENDPOINT_CONTROLEP)
+    return !(Model.ControlStatusPending);
+
+  return (Model.Endpoints[Model.Selected].Queued < Model.Endpoints[Model.Selected].Banks);
+}
+
+bool Endpoint_IsOUTReceived(void)
+{
+  return (Model.Endpoints[Model.Selected].Queued != 0);
+}
+
+uint16_t Endpoint_BytesInEndpoint(void)
+{
+  Model_Endpoint_t* Endpoint = &Model.Endpoints[Model.Selected];
+
+  if (Endpoint->IsIN)
+    return Endpoint->Position;
+
+  return (Endpoint->Queued ? (Endpoint->Count[Endpoint->CPUBank] - Endpoint->Position) : 0);
+}
+
+uint8_t Endpoint_Read_8(void)
+{
+  Model_Endpoint_t* Endpoint = &Model.Endpoints[Model.Selected];
+
+  if (Endpoint->IsIN || !(Endpoint->Queued) || (Endpoint->Position >= Endpoint->Count[Endpoint->CPUBank]))
+  {
+    fprintf(stderr, "Read past the end of OUT endpoint %u\n", Model.Selected);
+    abort();
+  }
+
+  Model.EndpointBytes++;
+  return Endpoint->Data[Endpoint->CPUBank][Endpoint->Position++];
+}
+
+void Endpoint_Write_8(const uint8_t Data)
+{
+  Model_Endpoint_t* Endpoint = &Model.Endpoints[Model.Selected];
+
+  if (!(Endpoint->IsIN) || (Endpoint->Queued == Endpoint->Banks) || (Endpoint->Position >= Endpoint->Size))
+  {
+    fprintf(stderr, "Write past the end of IN endpoint %u\n", Model.Selected);
+    abort();
+  }
+
+  Model.EndpointBytes++;
+  Endpoint->Data[Endpoint->CPUBank][Endpoint->Position++] = Data;
+}
+
+void Endpoint_Write_16_LE(const uint16_t Data)
+{
+  Endpoint_Write_8(Data & 0xFF);
+  Endpoint_Write_8(Data >> 8);
+}
+
+void Endpoint_ClearIN(void)
+{
+  Model_Endpoint_t* Endpoint = &Model.Endpoints[Model.Selected];
+
+  Endpoint->Count[Endpoint->CPUBank] = Endpoint->Position;
+  Endpoint->CPUBank  = ((Endpoint->CPUBank + 1) % Endpoint->Banks);
+  Endpoint->Position = 0;
+  Endpoint->Queued++;
+}
+
+void Endpoint_ClearOUT(void)
+{
+  Model_Endpoint_t* Endpoint = &Model.Endpoints[Model.Selected];
+
+  if (!(Endpoint->Queued))
+    return;
+
+  Endpoint->CPUBank  = ((Endpoint->CPUBank + 1) % Endpoint->Banks);
+  Endpoint->Position = 0;
+  Endpoint->Queued--;
+}
+
+void Endpoint_ClearSETUP(void)
+{
+}
+
+void Endpoint_ClearStatusStage(void)
+{
+  Model.ControlStatusPending = true;
+}
+
+void Endpoint_StallTransaction(void)
+{
+}
+
+uint8_t Endpoint_Write_Control_Stream_LE(const void* const Buffer, uint16_t Length)
+{
+  Model.ControlLength = MIN(Length, sizeof(Model.ControlData));
+  memcpy(Model.ControlData, Buffer, Model.ControlLength);
+  return 0;
+}
+
+/* LUFA CDC class driver */
+void CDC_Device_USBTask(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo)
+{
+}
+
+bool CDC_Device_ConfigureEndpoints(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo)
+{
+  const USB_Endpoint_Table_t* Tables[] = {&CDCInterfaceInfo->Config.NotificationEndpoint,
+                                          &CDCInterfaceInfo->Config.DataOUTEndpoint,
+                                          &CDCInterfaceInfo->Config.DataINEndpoint};
+
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    Model_Endpoint_t* Endpoint = &Model.Endpoints[Tables[i]->Address & 0x0F];
+
+    memset(Endpoint, 0, sizeof(Model_Endpoint_t));
+    Endpoint->Size  = Tables[i]->Size;
+    Endpoint->Banks = Tables[i]->Banks;
+    Endpoint->IsIN  = (Tables[i]->Address & ENDPOINT_DIR_IN);
+  }
+
+  return true;
+}
+
+void CDC_Device_ProcessControlRequest(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo)
+{
+  switch (USB_ControlRequest.bRequest)
+  {
+    case 0x20: /* Set Line Coding, 8N1 */
+      CDCInterfaceInfo->State.LineEncoding.BaudRateBPS = Model.PendingBaudRateBPS;
+      CDCInterfaceInfo->State.LineEncoding.CharFormat  = CDC_LINEENCODING_OneStopBit;
+      CDCInterfaceInfo->State.LineEncoding.ParityType  = CDC_PARITY_None;
+      CDCInterfaceInfo->State.LineEncoding.DataBits    = 8;
+      EVENT_CDC_Device_LineEncodingChanged(CDCInterfaceInfo);
+      Endpoint_ClearStatusStage();
+      break;
+    case 0x22: /* Set Control Line State */
+      CDCInterfaceInfo->State.ControlLineStates.HostToDevice = USB_ControlRequest.wValue;
+      EVENT_CDC_Device_ControLineStateChanged(CDCInterfaceInfo);
+      Endpoint_ClearStatusStage();
+      break;
+  }
+}
+
+void Model_DefaultConfig(Model_Config_t* const Config)
+{
+  *Config = (Model_Config_t)
+    {
+      .BaudRateBPS        = 115200,
+      .Bytes              = 100000,
+      .PassCycles         = 200,
+      .EndpointByteCycles = 8,
+      .RxISRCycles        = 60,
+      .UdreISRCycles      = 45,
+      .INPacketsPerFrame  = 10,
+      .OUTPacketsPerFrame = 20,
+    };
+}
+
+bool Model_Run(const Model_Config_t* const Config, Model_Result_t* const Result)
+{
+  int Pipe[2];
+
+  if (pipe(Pipe))
+    return false;
+
+  /* The firmware's static state only starts out right once, so every run gets a process of its own */
+  pid_t Child = fork();
+
+  if (Child < 0)
+    return false;
+
+  if (!(Child))
+  {
+    close(Pipe[0]);
+
+    Model.Config    = *Config;
+    Model.NextFrame = MODEL_FRAME_CYCLES;
+
+    /* Give up at a tenth of the line rate */
+    uint32_t Slowest = Config->BaudRateBPS;
+
+    if (Config->SwitchBaudRateBPS && (Config->SwitchBaudRateBPS < Slowest))
+      Slowest = Config->SwitchBaudRateBPS;
+
+    Model.Deadline  = (((uint64_t)Config->Bytes * 100 * F_CPU) / Slowest) + (F_CPU / 2);
+
+    if (!(setjmp(Model.Exit)))
+      Bridge_Main();
+
+    ssize_t Written = write(Pipe[1], &Model.Result, sizeof(Model.Result));
+    _exit(Written == sizeof(Model.Result) ? 0 : 1);
+  }
+
+  close(Pipe[1]);
+
+  ssize_t Read = read(Pipe[0], Result, sizeof(*Result));
+  int     Status;
+
+  close(Pipe[0]);
+  waitpid(Child, &Status, 0);
+
+  return ((Read == sizeof(*Result)) && WIFEXITED(Status) && !(WEXITSTATUS(Status)));
+}
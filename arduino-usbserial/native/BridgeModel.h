@@ -0,0 +1,106 @@
+/*
+  Copyright 2019  Modkit Inc. (open [at] modkit [dot] com)
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for BridgeModel.c, which runs the unmodified Arduino-usbserial.c main loop and ISRs against a model of
+ *  the USB host, the endpoint banks, USART1 and the target.
+ */
+
+#ifndef _BRIDGE_MODEL_H_
+#define _BRIDGE_MODEL_H_
+
+/* Includes: */
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Macros: */
+/** CPU cycles per 1 ms USB frame at 16 MHz. */
+#define MODEL_FRAME_CYCLES       16000UL
+
+/* Enums: */
+/** Directions data is streamed in by \ref Model_Run(). */
+enum Model_Directions_t
+{
+  MODEL_ECHO           = 0, /**< The host streams to the target, which echoes everything back. */
+  MODEL_HOST_TO_TARGET = 1, /**< The host streams to the target, which only checks what arrives. */
+  MODEL_TARGET_TO_HOST = 2, /**< The target streams to the host back-to-back, the host sends nothing. */
+};
+
+/* Type Defines: */
+/** Timing of the modelled system. The firmware's own cycle counts are estimates until they are replaced with figures
+ *  taken from the avr-gcc listing (Arduino-usbserial.lss).
+ */
+typedef struct
+{
+  uint32_t BaudRateBPS;         /**< Baud rate set with Set Line Coding, and used by the target. */
+  uint32_t Bytes;               /**< Bytes streamed from the sending end to the receiving end. */
+  uint8_t  Direction;           /**< Direction of the stream, a value from \ref Model_Directions_t. */
+  uint16_t PassCycles;          /**< CPU cycles of one main loop pass that moves no data. */
+  uint8_t  EndpointByteCycles;  /**< CPU cycles per byte moved between a ring buffer and an endpoint bank. */
+  uint8_t  RxISRCycles;         /**< CPU cycles of the USART receive ISR, including entry and exit. */
+  uint8_t  UdreISRCycles;       /**< CPU cycles of the USART data register empty ISR, including entry and exit. */
+  uint8_t  INPacketsPerFrame;   /**< Data IN packets the host collects per frame. */
+  uint8_t  OUTPacketsPerFrame;  /**< Data OUT packets the host sends per frame. */
+  uint16_t LatencyTimer;        /**< Value for the latency timer request, 0 to leave it off. */
+  bool     FrameMode;           /**< Set to turn on frame mode. */
+  uint32_t SwitchBaudRateBPS;   /**< Baud rate the host switches to once half of the bytes are sent, 0 to stay. */
+} Model_Config_t;
+
+/** Latency of one direction, from a byte entering the bridge's side of the link to it leaving the other side. */
+typedef struct
+{
+  uint64_t TotalCycles;         /**< Sum of the latencies of all measured bytes. */
+  uint32_t MaxCycles;           /**< Largest latency of a single byte. */
+  uint32_t Bytes;               /**< Bytes measured. */
+} Model_Latency_t;
+
+/** Results of a \ref Model_Run(). */
+typedef struct
+{
+  double          Seconds;      /**< Model time from the host configuring the bridge until the run ended. */
+  uint32_t        BytesOut;     /**< Bytes the host sent. */
+  uint32_t        BytesIn;      /**< Bytes the host received. */
+  uint32_t        TargetIn;     /**< Bytes the target received. */
+  uint32_t        TargetOut;    /**< Bytes the target sent. */
+  uint32_t        Mismatched;   /**< Bytes received by the host or the target that did not continue the pattern. */
+  uint32_t        INPackets;    /**< Data IN packets received by the host, not counting ZLPs. */
+  uint32_t        ZLPs;         /**< Zero length packets received by the host. */
+  uint32_t        OUTNAKs;      /**< Frames in which the host found both OUT banks full. */
+  uint16_t        HighWater;    /**< Most bytes seen in the USART to USB ring buffer. */
+  uint16_t        DroppedFull;  /**< Bytes the bridge dropped because its ring buffer was full, from its statistics. */
+  uint16_t        DataOverruns; /**< USART receive overruns counted in the bridge's statistics. */
+  uint32_t        Passes;       /**< Main loop passes. */
+  bool            Saturated;    /**< Set if the ISRs left no CPU time for the main loop. */
+  Model_Latency_t IN;           /**< From the end of a byte's stop bit at the bridge to the host collecting it. */
+  Model_Latency_t OUT;          /**< From the host sending a byte's OUT packet to the end of its stop bit at the target. */
+} Model_Result_t;
+
+/* Function Prototypes: */
+void Model_DefaultConfig(Model_Config_t* const Config);
+bool Model_Run(const Model_Config_t* const Config, Model_Result_t* const Result);
+void Model_SetLineCoding(const uint32_t BaudRateBPS);
+uint8_t Model_VendorRequestIn(const uint8_t Request, void* const Data, const uint16_t Length);
+uint16_t Model_GetUBRR(void);
+bool Model_GetDoubleSpeed(void);
+
+#endif
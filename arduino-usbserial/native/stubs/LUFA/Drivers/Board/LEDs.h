@@ -0,0 +1,2 @@
+/* Native build, see Native.h */
+#include "../../../Native.h"
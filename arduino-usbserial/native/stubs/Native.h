@@ -0,0 +1,278 @@
+/*
+  Copyright 2019  Modkit Inc. (open [at] modkit [dot] com)
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Stand-ins for the avr-libc and LUFA interfaces used by Arduino-usbserial.c, so that the bridge can be built with
+ *  the host compiler. Every avr-libc and LUFA header the firmware includes resolves to this file (see the stubs
+ *  directory). The registers are plain variables and the USB controller is a model of the endpoint banks, both driven
+ *  by BridgeModel.c.
+ */
+
+#ifndef _NATIVE_H_
+#define _NATIVE_H_
+
+/* Includes: */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Compiler and platform: */
+#define ATTR_PACKED              __attribute__ ((packed))
+#define ATTR_WARN_UNUSED_RESULT  __attribute__ ((warn_unused_result))
+#define ATTR_NON_NULL_PTR_ARG(...)
+#define PROGMEM
+#define CPU_TO_LE16(x)           (x)
+#define VERSION_BCD(Major, Minor, Revision) ((Major << 8) | (Minor << 4) | (Revision))
+#define MIN(x, y)                (((x) < (y)) ? (x) : (y))
+#define ARCH_AVR8                0
+#define ARCH                     -1
+
+/* Interrupts: */
+#define ISR(Vector, ...)         void Vector(void)
+#define ISR_BLOCK
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(Type)       for (uint8_t _AtomicDone = 0; !_AtomicDone; _AtomicDone = 1)
+#define GlobalInterruptEnable()
+
+void USART1_RX_vect(void);
+void USART1_UDRE_vect(void);
+
+/* Delays, they advance the model time while the main loop is held up: */
+void Model_Delay(const uint32_t Cycles);
+#define _delay_us(us)            Model_Delay((uint32_t)((us) * (F_CPU / 1000000UL)))
+#define Delay_MS(ms)             Model_Delay((uint32_t)(ms) * (F_CPU / 1000UL))
+
+/* Memory: */
+extern uint8_t Native_RAM[];
+extern uint8_t Native_EEPROM[];
+#define RAMSTART                 ((uintptr_t)Native_RAM)
+#define eeprom_read_byte(Address)         (Native_EEPROM[(uintptr_t)(Address)])
+#define eeprom_write_byte(Address, Value) (Native_EEPROM[(uintptr_t)(Address)] = (Value))
+
+/* Power and watchdog: */
+#define wdt_disable()
+#define clock_prescale_set(x)
+#define clock_div_1              0
+
+/* Registers, see the ATmega16U2 datasheet. Flags the hardware clears by writing a one are handled by the model. */
+extern volatile uint8_t  MCUSR, TIFR0, TCCR0A, TCCR0B, TCNT0, OCR0A;
+extern volatile uint8_t  PORTB, DDRB, PINB, PORTD, DDRD, GPIOR1, GPIOR2;
+extern volatile uint8_t  UCSR1A, UCSR1B, UCSR1C, UDR1, UEINTX;
+extern volatile uint16_t UBRR1;
+
+#define WDRF                     3
+#define OCF0A                    1
+#define CS00                     0
+#define CS01                     1
+#define WGM01                    1
+#define NAKOUTI                  4
+
+#define MPCM1                    0
+#define U2X1                     1
+#define UPE1                     2
+#define DOR1                     3
+#define FE1                      4
+#define UDRE1                    5
+#define TXC1                     6
+#define RXC1                     7
+
+#define TXB81                    0
+#define RXB81                    1
+#define UCSZ12                   2
+#define TXEN1                    3
+#define RXEN1                    4
+#define UDRIE1                   5
+#define TXCIE1                   6
+#define RXCIE1                   7
+
+#define UCPOL1                   0
+#define UCSZ10                   1
+#define UCSZ11                   2
+#define USBS1                    3
+#define UPM10                    4
+#define UPM11                    5
+
+/* LUFA serial driver: */
+#define SERIAL_UBBRVAL(Baud)     ((((F_CPU / 16) + (Baud / 2)) / (Baud)) - 1)
+
+/* LUFA board LEDs: */
+#define LEDS_LED1                (1 << 5)
+#define LEDS_LED2                (1 << 4)
+#define LEDs_Init()
+#define LEDs_TurnOnLEDs(Mask)
+#define LEDs_TurnOffLEDs(Mask)
+
+/* LUFA USB core: */
+#define FIXED_CONTROL_ENDPOINT_SIZE 8
+#define ENDPOINT_CONTROLEP       0
+#define ENDPOINT_DIR_OUT         0x00
+#define ENDPOINT_DIR_IN          0x80
+
+#define REQDIR_HOSTTODEVICE      (0 << 7)
+#define REQDIR_DEVICETOHOST      (1 << 7)
+#define REQTYPE_STANDARD         (0 << 5)
+#define REQTYPE_CLASS            (1 << 5)
+#define REQTYPE_VENDOR           (2 << 5)
+#define REQREC_DEVICE            (0 << 0)
+#define REQREC_INTERFACE         (1 << 0)
+
+enum USB_Device_States_t
+{
+  DEVICE_STATE_Unattached = 0,
+  DEVICE_STATE_Powered    = 1,
+  DEVICE_STATE_Default    = 2,
+  DEVICE_STATE_Addressed  = 3,
+  DEVICE_STATE_Configured = 4,
+  DEVICE_STATE_Suspended  = 5,
+};
+
+enum USB_DescriptorTypes_t
+{
+  DTYPE_DeviceCapability = 0x10,
+};
+
+enum USB_DeviceCapabilityTypes_t
+{
+  DCTYPE_Platform = 0x05,
+};
+
+typedef struct
+{
+  uint8_t  bmRequestType;
+  uint8_t  bRequest;
+  uint16_t wValue;
+  uint16_t wIndex;
+  uint16_t wLength;
+} USB_Request_Header_t;
+
+typedef struct
+{
+  uint8_t Size;
+  uint8_t Type;
+} ATTR_PACKED USB_Descriptor_Header_t;
+
+/* Only their sizes matter to Descriptors.h, the descriptors themselves are not built natively */
+typedef struct { uint8_t Data[9]; } USB_Descriptor_Configuration_Header_t;
+typedef struct { uint8_t Data[8]; } USB_Descriptor_Interface_Association_t;
+typedef struct { uint8_t Data[9]; } USB_Descriptor_Interface_t;
+typedef struct { uint8_t Data[7]; } USB_Descriptor_Endpoint_t;
+typedef struct { uint8_t Data[5]; } USB_CDC_Descriptor_FunctionalHeader_t;
+typedef struct { uint8_t Data[4]; } USB_CDC_Descriptor_FunctionalACM_t;
+typedef struct { uint8_t Data[5]; } USB_CDC_Descriptor_FunctionalUnion_t;
+
+extern volatile uint8_t     USB_DeviceState;
+extern USB_Request_Header_t USB_ControlRequest;
+
+void USB_Init(void);
+void USB_Disable(void);
+void USB_USBTask(void);
+void USB_Device_EnableSOFEvents(void);
+void USB_Device_DisableSOFEvents(void);
+
+/* LUFA endpoints, see BridgeModel.c: */
+void     Endpoint_SelectEndpoint(const uint8_t Address);
+bool     Endpoint_IsINReady(void);
+bool     Endpoint_IsOUTReceived(void);
+uint16_t Endpoint_BytesInEndpoint(void);
+uint8_t  Endpoint_Read_8(void);
+void     Endpoint_Write_8(const uint8_t Data);
+void     Endpoint_Write_16_LE(const uint16_t Data);
+void     Endpoint_ClearIN(void);
+void     Endpoint_ClearOUT(void);
+void     Endpoint_ClearSETUP(void);
+void     Endpoint_ClearStatusStage(void);
+void     Endpoint_StallTransaction(void);
+uint8_t  Endpoint_Write_Control_Stream_LE(const void* const Buffer, uint16_t Length);
+#define  Endpoint_Write_Control_PStream_LE(Buffer, Length) Endpoint_Write_Control_Stream_LE(Buffer, Length)
+
+/* LUFA CDC class driver: */
+#define CDC_CONTROL_LINE_OUT_DTR         (1 << 0)
+#define CDC_CONTROL_LINE_OUT_RTS         (1 << 1)
+#define CDC_CONTROL_LINE_IN_DCD          (1 << 0)
+#define CDC_CONTROL_LINE_IN_DSR          (1 << 1)
+#define CDC_CONTROL_LINE_IN_BREAK        (1 << 2)
+#define CDC_CONTROL_LINE_IN_RING         (1 << 3)
+#define CDC_CONTROL_LINE_IN_FRAMEERROR   (1 << 4)
+#define CDC_CONTROL_LINE_IN_PARITYERROR  (1 << 5)
+#define CDC_CONTROL_LINE_IN_OVERRUNERROR (1 << 6)
+
+#define CDC_NOTIF_SerialState            0x20
+
+enum CDC_LineEncodingFormats_t
+{
+  CDC_LINEENCODING_OneStopBit          = 0,
+  CDC_LINEENCODING_OneAndAHalfStopBits = 1,
+  CDC_LINEENCODING_TwoStopBits         = 2,
+};
+
+enum CDC_LineEncodingParity_t
+{
+  CDC_PARITY_None  = 0,
+  CDC_PARITY_Odd   = 1,
+  CDC_PARITY_Even  = 2,
+  CDC_PARITY_Mark  = 3,
+  CDC_PARITY_Space = 4,
+};
+
+typedef struct
+{
+  uint8_t Address;
+  uint16_t Size;
+  uint8_t Type;
+  uint8_t Banks;
+} USB_Endpoint_Table_t;
+
+typedef struct
+{
+  struct
+  {
+    uint8_t              ControlInterfaceNumber;
+    USB_Endpoint_Table_t DataINEndpoint;
+    USB_Endpoint_Table_t DataOUTEndpoint;
+    USB_Endpoint_Table_t NotificationEndpoint;
+  } Config;
+
+  struct
+  {
+    struct
+    {
+      uint16_t HostToDevice;
+      uint16_t DeviceToHost;
+    } ControlLineStates;
+
+    struct
+    {
+      uint32_t BaudRateBPS;
+      uint8_t  CharFormat;
+      uint8_t  ParityType;
+      uint8_t  DataBits;
+    } LineEncoding;
+  } State;
+} USB_ClassInfo_CDC_Device_t;
+
+void CDC_Device_USBTask(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo);
+bool CDC_Device_ConfigureEndpoints(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo);
+void CDC_Device_ProcessControlRequest(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo);
+
+#endif